@@ -0,0 +1,156 @@
+// Hardware address-space identifiers (ASIDs).
+//
+// Every process gets an ASID that is written into satp together with
+// its page table, so switching address spaces does not need to flush
+// the TLB: translations of other processes stay cached, tagged with
+// their own ASID, and kernel mappings are global (PTE_G).
+//
+// An ASID is a generation number in the high bits plus the hardware
+// tag in the low asid_bits bits. Tags are handed out in order and
+// never reused within a generation. When they run out, the generation
+// is bumped and every hart flushes its whole TLB before using a tag of
+// the new generation; processes still holding an old-generation ASID
+// get a fresh one the next time they are scheduled.
+//
+// Tag 0 is never handed out; kernel_pagetable runs with it.
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/asid.h"
+#include "include/printf.h"
+
+static struct {
+  struct spinlock lock;
+  int bits;                     // implemented ASID bits, 0 if none
+  uint64 generation;            // current generation, a multiple of 1 << bits
+  uint64 next;                  // next tag to hand out
+  int flush_pending[NCPU];      // hart must flush its TLB before the next switch
+} asids;
+
+#define ASID_MASK       ((1UL << asids.bits) - 1)
+
+// Find out how many ASID bits satp implements, by writing all ones
+// into the field and reading back what sticks. Called on hart 0 with
+// paging already on.
+void
+asidinit(void)
+{
+  initlock(&asids.lock, "asid");
+  asids.bits = 0;
+  #if defined(QEMU) && !defined(NOASID)
+  // k210 implements priv spec 1.9.1, whose sptbr has no ASID field
+  uint64 satp = r_satp();
+  w_satp(satp | (0xFFFFUL << SATP_ASID_SHIFT));
+  uint64 probe = r_satp();
+  w_satp(satp);
+  sfence_vma();
+  uint64 field = (probe >> SATP_ASID_SHIFT) & 0xFFFF;
+  while (field & 1) {
+    asids.bits++;
+    field >>= 1;
+  }
+  #endif
+  asids.generation = 1UL << asids.bits;
+  asids.next = 1;
+  #ifdef DEBUG
+  printf("asidinit: %d bits\n", asids.bits);
+  #endif
+}
+
+int
+asid_bits(void)
+{
+  return asids.bits;
+}
+
+// Hand out a tag of the current generation, starting a new generation
+// when they run out. Caller holds asids.lock.
+static uint64
+asid_new(void)
+{
+  if (asids.next > ASID_MASK) {
+    asids.generation += 1UL << asids.bits;
+    asids.next = 1;
+    for (int i = 0; i < NCPU; i++)
+      asids.flush_pending[i] = 1;
+  }
+  return asids.generation | asids.next++;
+}
+
+// Switch this hart to p's address space. Called by the scheduler
+// with interrupts off, just before running p.
+void
+asid_activate(struct proc *p)
+{
+  int id = cpuid();
+  int flush_all = 0, flush_asid = 0;
+
+  if (asids.bits == 0) {
+    // no ASIDs: every switch has to start from a clean TLB
+    w_satp(MAKE_SATP(p->pagetable));
+    sfence_vma();
+    p->asid_cpu = id;
+    return;
+  }
+
+  acquire(&asids.lock);
+  if ((p->asid & ~ASID_MASK) != asids.generation)
+    p->asid = asid_new();
+  else if (p->asid_cpu != id)
+    flush_asid = 1;   // may have changed its page table on another hart
+  if (asids.flush_pending[id]) {
+    asids.flush_pending[id] = 0;
+    flush_all = 1;
+  }
+  release(&asids.lock);
+
+  p->asid_cpu = id;
+  w_satp(MAKE_SATP_ASID(p->pagetable, p->asid & ASID_MASK));
+  if (flush_all)
+    sfence_vma();
+  else if (flush_asid)
+    sfence_vma_asid(p->asid & ASID_MASK);
+}
+
+// p's cached translations can no longer be trusted on any hart, e.g.
+// after exec replaced its page table or another process edited it.
+// Instead of flushing every hart, give p a fresh ASID next time it runs.
+// p must not be running on another hart.
+void
+asid_invalidate(struct proc *p)
+{
+  p->asid = 0;
+}
+
+// Flush p's translations for the npages pages starting at va on this
+// hart, one sfence.vma per page. Long ranges are cheaper to drop as a
+// whole, so above TLB_FLUSH_MAX pages flush p's entire ASID instead.
+void
+sfence_vma_range(struct proc *p, uint64 va, uint64 npages)
+{
+  if (npages > TLB_FLUSH_MAX) {
+    sfence_vma_proc(p);
+    return;
+  }
+  va = PGROUNDDOWN(va);
+  for (uint64 i = 0; i < npages; i++, va += PGSIZE) {
+    if (asids.bits == 0 || p == 0)
+      sfence_vma_addr(va);
+    else
+      sfence_vma_addr_asid(va, p->asid & ASID_MASK);
+  }
+}
+
+// Flush p's user translations on this hart after p changed its own
+// page table. Kernel mappings are global and survive.
+void
+sfence_vma_proc(struct proc *p)
+{
+  if (asids.bits == 0 || p == 0)
+    sfence_vma();
+  else
+    sfence_vma_asid(p->asid & ASID_MASK);
+}
@@ -51,16 +51,19 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
+  int i, j, m;
+  char buf[32];
 
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  // copy outside cons.lock: faulting a user page in may sleep
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    sbi_console_putchar(c);
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      sbi_console_putchar(buf[j]);
+    release(&cons.lock);
   }
-  release(&cons.lock);
 
   return i;
 }
@@ -103,8 +106,12 @@ consoleread(int user_dst, uint64 dst, int n)
     }
 
     // copy the input byte to the user-space buffer.
+    // the copy may fault a page in and sleep, so drop the lock.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    release(&cons.lock);
+    int r = either_copyout(user_dst, dst, &cbuf, 1);
+    acquire(&cons.lock);
+    if(r == -1)
       break;
 
     dst++;
@@ -6,42 +6,29 @@
 #include "include/spinlock.h"
 #include "include/sleeplock.h"
 #include "include/proc.h"
+#include "include/asid.h"
+#include "include/intr.h"
 #include "include/elf.h"
 #include "include/fat32.h"
 #include "include/kalloc.h"
 #include "include/vm.h"
 #include "include/printf.h"
 #include "include/string.h"
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
+#include "include/exec.h"
+#include "include/file.h"
+#include "include/vma.h"
+
+extern char trampoline[]; // trampoline.S
+
+// Load the program at path with arguments argv into a new user page
+// table, without touching any process. The trapframe is mapped later
+// by exec_install(), once the owning process is known.
+// Program segments are not read here: each PT_LOAD becomes a private
+// file-backed VMA, and its pages are read from the executable on the
+// first fault. Only the stack is allocated up front.
 // Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct dirent *ep, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-  if((va % PGSIZE) != 0)
-    panic("loadseg: va must be page aligned");
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == NULL)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(eread(ep, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-
-  return 0;
-}
-
-
-int exec(char *path, char **argv)
+int
+exec_prepare(char *path, char **argv, struct execimage *img)
 {
   char *s, *last;
   int i, off;
@@ -49,19 +36,10 @@ int exec(char *path, char **argv)
   struct elfhdr elf;
   struct dirent *ep;
   struct proghdr ph;
-  pagetable_t pagetable = 0, oldpagetable;
-  pagetable_t kpagetable = 0, oldkpagetable;
-  struct proc *p = myproc();
+  struct file *f = 0;
+  pagetable_t pagetable = 0;
 
-  // Make a copy of p->kpt without old user space, 
-  // but with the same kstack we are using now, which can't be changed
-  if ((kpagetable = (pagetable_t)kalloc()) == NULL) {
-    return -1;
-  }
-  memmove(kpagetable, p->kpagetable, PGSIZE);
-  for (int i = 0; i < PX(2, MAXUVA); i++) {
-    kpagetable[i] = 0;
-  }
+  vma_init(&img->vmas);
 
   if((ep = ename(path)) == NULL) {
     #ifdef DEBUG
@@ -76,10 +54,22 @@ int exec(char *path, char **argv)
     goto bad;
   if(elf.magic != ELF_MAGIC)
     goto bad;
-  if((pagetable = proc_pagetable(p)) == NULL)
+  if((pagetable = uvmcreate()) == NULL)
     goto bad;
+  // the trampoline is not PTE_U, see proc_pagetable().
+  if(mappages(pagetable, TRAMPOLINE, PGSIZE, (uint64)trampoline, PTE_R | PTE_X) < 0)
+    goto bad;
+
+  // The segment VMAs share one read-only open file on the executable.
+  if((f = filealloc()) == 0)
+    goto bad;
+  f->type = FD_ENTRY;
+  f->readable = 1;
+  f->writable = 0;
+  f->ep = edup(ep);
+  f->off = 0;
 
-  // Load program into memory.
+  // Register the program segments; nothing is read yet.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(eread(ep, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -87,29 +77,37 @@ int exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz > MAXUVA)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, kpagetable, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    sz = sz1;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ep, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    int prot = 0;
+    if(ph.flags & ELF_PROG_FLAG_READ)
+      prot |= PROT_READ;
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      prot |= PROT_WRITE;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      prot |= PROT_EXEC;
+    filedup(f);
+    if(vma_insert(&img->vmas, ph.vaddr, ph.memsz, ph.off, ph.filesz,
+                  prot, MAP_PRIVATE, f) < 0){
+      fileclose(f);
       goto bad;
+    }
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
   eunlock(ep);
   eput(ep);
   ep = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
   uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, kpagetable, sz, sz + 2*PGSIZE)) == 0)
+  if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
   sz = sz1;
   uvmclear(pagetable, sz-2*PGSIZE);
@@ -138,30 +136,19 @@ int exec(char *path, char **argv)
   if(copyout(pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
     goto bad;
 
-  // arguments to user main(argc, argv)
-  // argc is returned via the system call return
-  // value, which goes in a0.
-  p->trapframe->a1 = sp;
-
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(p->name, last, sizeof(p->name));
-    
-  // Commit to the user image.
-  oldpagetable = p->pagetable;
-  oldkpagetable = p->kpagetable;
-  p->pagetable = pagetable;
-  p->kpagetable = kpagetable;
-  p->sz = sz;
-  p->trapframe->epc = elf.entry;  // initial program counter = main
-  p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
-  w_satp(MAKE_SATP(p->kpagetable));
-  sfence_vma();
-  kvmfree(oldkpagetable, 0);
-  return argc; // this ends up in a0, the first argument to main(argc, argv)
+  safestrcpy(img->name, last, sizeof(img->name));
+
+  img->pagetable = pagetable;
+  img->sz = sz;
+  img->entry = elf.entry;
+  img->sp = sp;
+  img->argc = argc;
+  fileclose(f);     // the VMAs hold their own references
+  return 0;
 
  bad:
   #ifdef DEBUG
@@ -169,11 +156,85 @@ int exec(char *path, char **argv)
   #endif
   if(pagetable)
     proc_freepagetable(pagetable, sz);
-  if(kpagetable)
-    kvmfree(kpagetable, 0);
   if(ep){
     eunlock(ep);
     eput(ep);
   }
+  vma_cleanup(&img->vmas);
+  if(f)
+    fileclose(f);
   return -1;
 }
+
+// Free an image that exec_install() did not take.
+void
+exec_discard(struct execimage *img)
+{
+  proc_freepagetable(img->pagetable, img->sz);
+  img->pagetable = 0;
+  vma_cleanup(&img->vmas);
+}
+
+// Replace p's user memory with img. p is either the caller, or a
+// new process that has never run. When p is the caller this may
+// sleep: dirty MAP_SHARED pages are written back and the old
+// mappings' files closed. spawn() calls it for a fresh child with
+// np->lock held; the child has no VMAs yet, so nothing sleeps then.
+// Returns 0 on success; on failure img is left to the caller.
+int
+exec_install(struct proc *p, struct execimage *img)
+{
+  pagetable_t oldpagetable;
+  uint64 oldsz;
+
+  // map the trapframe just below TRAMPOLINE, for trampoline.S.
+  if(mappages(img->pagetable, TRAPFRAME, PGSIZE,
+              (uint64)(p->trapframe), PTE_R | PTE_W) < 0)
+    return -1;
+
+  // arguments to user main(argc, argv)
+  // for exec() argc is also the system call return value.
+  p->trapframe->a0 = img->argc;
+  p->trapframe->a1 = img->sp;
+  safestrcpy(p->name, img->name, sizeof(p->name));
+
+  // Commit to the user image.
+  oldpagetable = p->pagetable;
+  oldsz = p->sz;
+  p->pagetable = img->pagetable;
+  p->sz = img->sz;
+  p->fault_around = FAULT_AROUND;  // hints described the old image
+  p->heap_advice = MADV_NORMAL;
+  p->trapframe->epc = img->entry;  // initial program counter = main
+  p->trapframe->sp = img->sp; // initial stack pointer
+  img->pagetable = 0;
+  // the old ASID's translations are stale now; take a new one.
+  asid_invalidate(p);
+  if(p == myproc()){
+    // we are running on the old page table; switch away from it
+    // before it is freed. the kernel half is shared, so our stack
+    // and code stay mapped.
+    push_off();
+    asid_activate(p);
+    pop_off();
+  }
+  // the old mmap regions and segments go with the old page table.
+  vma_unmapall(&p->vma_manager, oldpagetable);
+  vma_cleanup(&p->vma_manager);
+  vma_move(&p->vma_manager, &img->vmas);
+  proc_freepagetable(oldpagetable, oldsz);
+  return 0;
+}
+
+int exec(char *path, char **argv)
+{
+  struct execimage img;
+
+  if(exec_prepare(path, argv, &img) < 0)
+    return -1;
+  if(exec_install(myproc(), &img) < 0){
+    exec_discard(&img);
+    return -1;
+  }
+  return img.argc; // this ends up in a0, the first argument to main(argc, argv)
+}
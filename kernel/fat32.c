@@ -11,6 +11,8 @@
 #include "include/printf.h"
 #include "include/timer.h"
 #include "include/kalloc.h"
+#include "include/slab.h"
+#include "include/pagecache.h"
 
 /* fields that start with "_" are something we don't use */
 
@@ -111,9 +113,17 @@ static struct
 static struct entry_cache
 {
     struct spinlock lock;
-    struct dirent entries[ENTRY_CACHE_NUM];
+    struct kmem_cache *cache;   // dirent 从 slab 分配，全部被引用时按需扩充
+    int nentry;
 } ecache;
 
+static void dirent_ctor(void *obj)
+{
+    struct dirent *de = obj;
+    memset(de, 0, sizeof(struct dirent));
+    initsleeplock(&de->lock, "entry");
+}
+
 // Initialize the FAT cache
 static void fat_cache_init(void) {
     fcache.capacity = FAT_CACHE_SIZE;
@@ -300,18 +310,18 @@ int fat32_init()
     root.valid = 1;
     root.prev = &root;
     root.next = &root;
-    for (struct dirent *de = ecache.entries; de < ecache.entries + ENTRY_CACHE_NUM; de++)
+    ecache.cache = kmem_cache_create("dirent", sizeof(struct dirent), dirent_ctor);
+    ecache.nentry = 0;
+    for (int i = 0; i < ENTRY_CACHE_NUM; i++)
     {
-        de->dev = 0;
-        de->valid = 0;
-        de->ref = 0;
-        de->dirty = 0;
-        de->parent = 0;
+        struct dirent *de = kmem_cache_alloc(ecache.cache);
+        if (de == NULL)
+            panic("fat32_init: ecache");
         de->next = root.next;
         de->prev = &root;
-        initsleeplock(&de->lock, "entry");
         root.next->prev = de;
         root.next = de;
+        ecache.nentry++;
     }
     return 0;
 }
@@ -563,8 +573,7 @@ int eread(struct dirent *entry, int user_dst, uint64 dst, uint off, uint n)
     return tot;
 }
 
-// Caller must hold entry->lock.
-int ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n)
+static int ewrite1(struct dirent *entry, int user_src, uint64 src, uint off, uint n)
 {
     if (off > entry->file_size || off + n < off || (uint64)off + n > 0xffffffff || (entry->attribute & ATTR_READ_ONLY))
     {
@@ -606,6 +615,26 @@ int ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n)
     return tot;
 }
 
+// Caller must hold entry->lock.
+int ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n)
+{
+    int r = ewrite1(entry, user_src, src, off, n);
+    if (r > 0)
+        pcache_written(entry, off, r, 1); // cached pages would go stale
+    return r;
+}
+
+// Write back n bytes of a MAP_SHARED page at kernel address pa.
+// The page is the cached copy itself, so it is not re-read.
+// Caller must hold entry->lock.
+int ewriteback(struct dirent *entry, uint64 pa, uint off, uint n)
+{
+    int r = ewrite1(entry, 0, pa, off, n);
+    if (r > 0)
+        pcache_written(entry, off, r, 0);
+    return r;
+}
+
 // Returns a dirent struct. If name is given, check ecache. It is difficult to cache entries
 // by their whole path. But when parsing a path, we open all the directories through it,
 // which forms a linked list from the final file to the root. Thus, we use the "parent" pointer
@@ -644,6 +673,7 @@ static struct dirent *eget(struct dirent *parent, char *name)
     { // LRU algo
         if (ep->ref == 0)
         {
+            pcache_drop(ep); // the entry is about to name another file
             ep->ref = 1;
             ep->dev = parent->dev;
             ep->off = 0;
@@ -653,8 +683,22 @@ static struct dirent *eget(struct dirent *parent, char *name)
             return ep;
         }
     }
-    panic("eget: insufficient ecache");
-    return 0;
+    // 所有缓存项都在使用中，从 slab 中再分配一个
+    if ((ep = kmem_cache_alloc(ecache.cache)) == NULL)
+        panic("eget: insufficient ecache");
+    ep->ref = 1;
+    ep->dev = parent->dev;
+    ep->off = 0;
+    ep->valid = 0;
+    ep->dirty = 0;
+    ep->parent = 0;
+    ep->next = root.next;
+    ep->prev = &root;
+    root.next->prev = ep;
+    root.next = ep;
+    ecache.nentry++;
+    release(&ecache.lock);
+    return ep;
 }
 
 // trim ' ' in the head and tail, '.' in head, and test legality
@@ -1164,6 +1208,7 @@ void eremove(struct dirent *entry)
 // caller must hold entry->lock
 void etrunc(struct dirent *entry)
 {
+    pcache_drop(entry);
     for (uint32 clus = entry->first_clus; clus >= 2 && clus < FAT32_EOC;)
     {
         uint32 next = read_fat(clus);
@@ -0,0 +1,114 @@
+// Minimal flattened device tree parser.
+// The kernel only needs one thing from the DTB handed over by the
+// SBI firmware: the extent of the physical memory it runs in.
+// Called before paging is enabled, so the blob is read by its
+// physical address.
+
+#include "include/types.h"
+#include "include/fdt.h"
+#include "include/string.h"
+
+static inline uint32
+fdt32(const void *p)
+{
+  const uint8 *b = p;
+  return ((uint32)b[0] << 24) | ((uint32)b[1] << 16) | ((uint32)b[2] << 8) | b[3];
+}
+
+// 读取 n 个 32 位 cell 组成的数（n 为 1 或 2）
+static uint64
+fdt_cells(const uint8 *p, int n)
+{
+  uint64 v = 0;
+  while (n-- > 0) {
+    v = (v << 32) | fdt32(p);
+    p += 4;
+  }
+  return v;
+}
+
+static inline const uint8 *
+fdt_align(const uint8 *p)
+{
+  return (const uint8 *)(((uint64)p + 3) & ~3UL);
+}
+
+// 节点名是否为 "memory" 或 "memory@..."
+static int
+is_memory_node(const char *name)
+{
+  return strncmp(name, "memory", 6) == 0 && (name[6] == '\0' || name[6] == '@');
+}
+
+// 在设备树的 memory 节点中查找包含物理地址 addr 的内存区间。
+// 成功返回 0，并通过 base/size 返回该区间；DTB 无效或没有找到返回 -1。
+int
+fdt_memory(uint64 dtb_pa, uint64 addr, uint64 *base, uint64 *size)
+{
+  const struct fdt_header *fdt = (const struct fdt_header *)dtb_pa;
+
+  if (dtb_pa == 0 || (dtb_pa & 3) != 0 || fdt32(&fdt->magic) != FDT_MAGIC)
+    return -1;
+
+  const uint8 *p = (const uint8 *)dtb_pa + fdt32(&fdt->off_dt_struct);
+  const uint8 *end = p + fdt32(&fdt->size_dt_struct);
+  const char *strings = (const char *)dtb_pa + fdt32(&fdt->off_dt_strings);
+
+  int depth = 0;
+  int addr_cells = 2, size_cells = 1;   // 根节点的默认值
+  int in_memory = 0;
+
+  while (p < end) {
+    uint32 token = fdt32(p);
+    p += 4;
+
+    switch (token) {
+    case FDT_BEGIN_NODE: {
+      const char *name = (const char *)p;
+      depth++;
+      // 只关心根节点下一层的 memory 节点
+      in_memory = (depth == 2 && is_memory_node(name));
+      p = fdt_align(p + strlen(name) + 1);
+      break;
+    }
+    case FDT_END_NODE:
+      depth--;
+      in_memory = 0;
+      break;
+    case FDT_PROP: {
+      uint32 len = fdt32(p);
+      const char *pname = strings + fdt32(p + 4);
+      const uint8 *val = p + 8;
+      p = fdt_align(val + len);
+
+      if (depth == 1) {
+        if (strncmp(pname, "#address-cells", 15) == 0)
+          addr_cells = fdt32(val);
+        else if (strncmp(pname, "#size-cells", 12) == 0)
+          size_cells = fdt32(val);
+      } else if (in_memory && strncmp(pname, "reg", 4) == 0) {
+        int entsz = (addr_cells + size_cells) * 4;
+        if (addr_cells < 1 || addr_cells > 2 || size_cells < 1 || size_cells > 2)
+          return -1;
+        for (const uint8 *r = val; r + entsz <= val + len; r += entsz) {
+          uint64 b = fdt_cells(r, addr_cells);
+          uint64 s = fdt_cells(r + addr_cells * 4, size_cells);
+          if (b <= addr && addr < b + s) {
+            *base = b;
+            *size = s;
+            return 0;
+          }
+        }
+      }
+      break;
+    }
+    case FDT_NOP:
+      break;
+    case FDT_END:
+      return -1;
+    default:
+      return -1;    // 格式错误
+    }
+  }
+  return -1;
+}
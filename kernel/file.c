@@ -16,21 +16,25 @@
 #include "include/printf.h"
 #include "include/string.h"
 #include "include/vm.h"
+#include "include/slab.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;   // 保护 file 的引用计数
+  struct kmem_cache *cache;
 } ftable;
 
+static void
+file_ctor(void *obj)
+{
+  memset(obj, 0, sizeof(struct file));
+}
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
-  struct file *f;
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    memset(f, 0, sizeof(struct file));
-  }
+  ftable.cache = kmem_cache_create("file", sizeof(struct file), file_ctor);
   #ifdef DEBUG
   printf("fileinit\n");
   #endif
@@ -42,16 +46,10 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return NULL;
+  if((f = kmem_cache_alloc(ftable.cache)) == NULL)
+    return NULL;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -80,9 +78,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  memset(f, 0, sizeof(struct file));
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
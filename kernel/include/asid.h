@@ -0,0 +1,19 @@
+#ifndef __ASID_H
+#define __ASID_H
+
+#include "types.h"
+
+struct proc;
+
+void            asidinit(void);
+void            asid_activate(struct proc *p);
+void            asid_invalidate(struct proc *p);
+void            sfence_vma_proc(struct proc *p);
+void            sfence_vma_range(struct proc *p, uint64 va, uint64 npages);
+
+// ranges longer than this many pages are flushed by ASID instead
+// of page by page
+#define TLB_FLUSH_MAX   32
+int             asid_bits(void);
+
+#endif
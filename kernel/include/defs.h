@@ -88,9 +88,16 @@ int             dirnext(struct file *f, uint64 addr);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+int             kmem_prezero(int n);
+void            kmem_zerostat(uint64 *cached, uint64 *hit, uint64 *miss);
 void            kfree(void *);
-void            kinit(void);
+void*           kalloc_pages(int order);
+void            kfree_pages(void *pa, int order);
+void            kmem_buddystat(uint64 *nr_free);
+void            kinit(uint64 dtb_pa);
 uint64          freemem_amount(void);
+void            kmem_pcpstat(int cpu, uint64 *hit, uint64 *refill, uint64 *drain, uint64 *cached);
 
 // log.c
 // void            initlog(int, struct superblock*);
@@ -99,6 +106,7 @@ uint64          freemem_amount(void);
 // void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -200,18 +208,22 @@ uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
-void            uvminit(pagetable_t, pagetable_t, uchar *, uint);
-uint64          uvmalloc(pagetable_t, pagetable_t, uint64, uint64);
-uint64          uvmdealloc(pagetable_t, pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, pagetable_t, uint64);
+void            uvminit(pagetable_t, uchar *, uint);
+uint64          uvmalloc(pagetable_t, uint64, uint64);
+uint64          uvmdealloc(pagetable_t, uint64, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmprotect(pagetable_t pagetable, uint64 va, uint64 npages, int perm, int shared);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
-int             lazy_alloc(pagetable_t pagetable, pagetable_t kpagetable, uint64 va);
+struct vma;
+int             fault_around(struct proc *p, uint64 va, uint64 lo, uint64 hi, int perm, int write, struct vma *fv, int advice);
+int             uvmfault(struct proc *p, uint64 va, int write);
+int             fault_megapage(struct proc *p, uint64 va, uint64 lo, uint64 hi, int perm);
 int             is_cow_page(pagetable_t pagetable, uint64 va);
 int             cow_alloc(pagetable_t pagetable, uint64 va);
 
@@ -0,0 +1,28 @@
+#ifndef __EXEC_H
+#define __EXEC_H
+
+#include "types.h"
+#include "riscv.h"
+#include "vma.h"
+
+struct proc;
+
+// A loaded program that has not been given to a process yet.
+// exec() builds one and installs it into the caller; spawn()
+// installs it into a fresh child instead.
+struct execimage {
+  pagetable_t pagetable;  // user memory and trampoline, no trapframe
+  uint64 sz;
+  uint64 entry;           // initial pc
+  uint64 sp;              // initial sp, argv[] lives here
+  uint64 argc;
+  char name[16];
+  struct vma_manager vmas; // program segments, faulted in from the file
+};
+
+int             exec(char *path, char **argv);
+int             exec_prepare(char *path, char **argv, struct execimage *img);
+int             exec_install(struct proc *p, struct execimage *img);
+void            exec_discard(struct execimage *img);
+
+#endif
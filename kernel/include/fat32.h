@@ -21,7 +21,7 @@
 
 #define FAT32_MAX_FILENAME  255
 #define FAT32_MAX_PATH      260
-#define ENTRY_CACHE_NUM     50
+#define ENTRY_CACHE_NUM     50      // initial size of the entry cache, grows on demand
 
 struct dirent {
     char  filename[FAT32_MAX_FILENAME + 1];
@@ -44,6 +44,7 @@ struct dirent {
     short   valid;
     int     ref;
     uint32  off;            // offset in the parent dir entry, for writing convenience
+    int     ncached;        // pages of this file in the page cache, see pagecache.c
     struct dirent *parent;  // because FAT32 doesn't have such thing like inum, use this for cache trick
     struct dirent *next;
     struct dirent *prev;
@@ -68,5 +69,6 @@ struct dirent*  ename(char *path);
 struct dirent*  enameparent(char *path, char *name);
 int             eread(struct dirent *entry, int user_dst, uint64 dst, uint off, uint n);
 int             ewrite(struct dirent *entry, int user_src, uint64 src, uint off, uint n);
+int             ewriteback(struct dirent *entry, uint64 pa, uint off, uint n);
 
 #endif
\ No newline at end of file
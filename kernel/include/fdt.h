@@ -0,0 +1,30 @@
+#ifndef __FDT_H
+#define __FDT_H
+
+#include "types.h"
+
+// Flattened Device Tree (DTB) 头部，所有字段均为大端序
+struct fdt_header {
+  uint32 magic;
+  uint32 totalsize;
+  uint32 off_dt_struct;
+  uint32 off_dt_strings;
+  uint32 off_mem_rsvmap;
+  uint32 version;
+  uint32 last_comp_version;
+  uint32 boot_cpuid_phys;
+  uint32 size_dt_strings;
+  uint32 size_dt_struct;
+};
+
+#define FDT_MAGIC       0xd00dfeed
+
+#define FDT_BEGIN_NODE  0x1
+#define FDT_END_NODE    0x2
+#define FDT_PROP        0x3
+#define FDT_NOP         0x4
+#define FDT_END         0x9
+
+int             fdt_memory(uint64 dtb_pa, uint64 addr, uint64 *base, uint64 *size);
+
+#endif
@@ -4,8 +4,18 @@
 #include "types.h"
 
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+int             kmem_prezero(int n);
+void            kmem_zerostat(uint64 *cached, uint64 *hit, uint64 *miss);
 void            kfree(void *);
-void            kinit(void);
+void*           kalloc_pages(int order);
+void            kfree_pages(void *pa, int order);
+void            incref(uint64 pa);
+void            decref(uint64 pa);
+int             getref(uint64 pa);
+void            kmem_buddystat(uint64 *nr_free);
+void            kinit(uint64 dtb_pa);
 uint64          freemem_amount(void);
+void            kmem_pcpstat(int cpu, uint64 *hit, uint64 *refill, uint64 *drain, uint64 *cached);
 
 #endif
\ No newline at end of file
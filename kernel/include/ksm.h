@@ -0,0 +1,12 @@
+#ifndef __KSM_H
+#define __KSM_H
+
+#include "types.h"
+
+void            ksminit(void);
+int             ksm_scan(void);
+int             ksm_set(int on);
+void            ksm_stat(uint64 *shared, uint64 *saved, uint64 *scanned,
+                         uint64 *merged, uint64 *passes);
+
+#endif
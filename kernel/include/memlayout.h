@@ -95,23 +95,27 @@
 
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
-// from physical address 0x80200000 to PHYSTOP.
+// from physical address KERNBASE to PHYSTOP.
 #ifndef QEMU
 #define KERNBASE                0x80020000
 #else
 #define KERNBASE                0x80200000
 #endif
 
-#define PHYSTOP                 0x80600000
+// PHYSTOP 在启动时由 kinit() 根据设备树中的 memory 节点确定，
+// 读取失败（或 k210 平台）时使用 PHYSTOP_DEFAULT
+#define PHYSTOP_DEFAULT         0x80600000
+#define PHYSTOP                 phystop
+extern uint64 phystop;
 
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE              (MAXVA - PGSIZE)
 
-// map kernel stacks beneath the trampoline,
-// each surrounded by invalid guard pages.
-// #define KSTACK(p)               (TRAMPOLINE - ((p) + 1) * 2 * PGSIZE)
+// map kernel stacks in their own region of the shared kernel
+// page table, each above an invalid guard page.
 #define VKSTACK                 0x3EC0000000L
+#define KSTACK(p)               (VKSTACK + ((p) * 2 + 1) * PGSIZE)
 
 // User memory layout.
 // Address zero first:
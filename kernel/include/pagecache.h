@@ -0,0 +1,14 @@
+#ifndef __PAGECACHE_H
+#define __PAGECACHE_H
+
+#include "types.h"
+
+struct dirent;
+
+void            pcacheinit(void);
+uint64          pcache_get(struct dirent *ep, uint off, uint len, int shared);
+void            pcache_drop(struct dirent *ep);
+void            pcache_written(struct dirent *ep, uint off, uint n, int refresh);
+void            pcache_stat(uint64 *npages, uint64 *hit, uint64 *miss);
+
+#endif
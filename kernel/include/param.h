@@ -4,7 +4,6 @@
 #define NPROC        50  // maximum number of processes
 #define NCPU          2  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
@@ -15,6 +14,18 @@
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      260   // maximum file path name
 #define INTERVAL     (390000000 / 200) // timer interrupt interval
+#define KMEM_MAX_ORDER 10  // largest buddy block: 2^10 pages (4 MiB)
+#define KMEM_PREZERO_BATCH 4  // pages zeroed per idle pass of scheduler()
+#define FAULT_AROUND     16  // default pages mapped per lazy fault, see faultaround()
+#define FAULT_AROUND_MAX 64  // largest window a process may ask for
+#define PCACHE_PAGES    128  // max pages in the shared file page cache
+#define SWAP_PAGES     1024  // max slots used in the swap file
+#define SWAP_LOWMEM      32  // free pages below which faults reclaim first
+#define SWAP_BATCH       16  // pages evicted per reclaim
+#define ZRAM_PAGES      256  // max memory the compressed swap store may use, in pages
+#define KSM_BATCH        32  // pages the same-page scanner hashes per tick
+#define KSM_STABLE      128  // max pages shared by the same-page scanner
+#define KSM_UNSTABLE    512  // page hashes remembered per scan pass
 
 // Multi-level Feedback Queue (MLFQ) configuration
 #define MFQ_NQUEUES      3           // Number of queue levels
@@ -14,8 +14,10 @@ struct pipe {
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int reading;    // a reader is copying data out, see piperead()
 };
 
+void pipeinit(void);
 int pipealloc(struct file **f0, struct file **f1);
 void pipeclose(struct pipe *pi, int writable);
 int pipewrite(struct pipe *pi, uint64 addr, int n);
@@ -59,7 +59,8 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
-  pagetable_t kpagetable;      // Kernel page table
+  uint64 asid;                 // Hardware ASID with generation, see asid.c
+  int asid_cpu;                // Hart that last ran with this ASID
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
@@ -87,6 +88,14 @@ struct proc {
   int sandbox_action;          // 0: deny(-1), future: send signal, etc.
   uint32 allow_mask[4];        // 128-bit allow mask for syscall numbers
 
+  // Fault-around for lazy heap and anonymous mmap faults
+  int fault_around;            // Pages mapped per fault (1 disables)
+  uint64 nfault;               // Page faults resolved by mapping memory
+  uint64 nfault_saved;         // Neighbour pages mapped ahead of a fault
+  int heap_advice;             // madvise() access pattern of the sbrk heap
+  int uaccess;                 // Inside uaccess_copy(): kernel touching user pages
+  int vmbusy;                  // Kernel is editing p->pagetable: swap and KSM keep out
+
   // Virtual Memory Area (VMA) management for mmap
   struct vma_manager vma_manager;  // VMA 管理器
 };
@@ -95,6 +104,8 @@ void            reg_info(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+struct spawn_action;
+int             spawn(char *, char **, struct spawn_action *, int);
 int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -15,6 +15,8 @@ struct procinfo {
   uint64 stime;         // Kernel mode ticks
   uint64 start_time;    // Process start time (ticks since boot)
   uint64 sz;            // Process memory size (bytes)
+  uint64 nfault;        // Page faults that mapped memory
+  uint64 nfault_saved;  // Faults avoided by fault-around
   char name[16];        // Process name
 };
 
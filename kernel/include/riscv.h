@@ -43,6 +43,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User Memory
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -188,6 +189,8 @@ w_mtvec(uint64 x)
 #define SATP_SV39 (8L << 60)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+#define SATP_ASID_SHIFT 44
+#define MAKE_SATP_ASID(pagetable, asid) (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -333,6 +336,29 @@ sfence_vma()
   asm volatile("sfence.vma");
 }
 
+// flush the TLB entries for one virtual address,
+// in every address space.
+static inline void
+sfence_vma_addr(uint64 va)
+{
+  asm volatile("sfence.vma %0, zero" : : "r" (va) : "memory");
+}
+
+// flush the non-global TLB entries for one virtual address
+// tagged with asid.
+static inline void
+sfence_vma_addr_asid(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid) : "memory");
+}
+
+// flush the non-global TLB entries tagged with asid.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid) : "memory");
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -340,11 +366,21 @@ sfence_vma()
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+// a level-1 leaf PTE maps a 2 MiB megapage.
+#define MEGAPGORDER 9   // 2^9 pages per megapage
+#define MEGAPGSIZE (PGSIZE << MEGAPGORDER)
+#define MEGAPGROUNDUP(sz)  (((sz)+MEGAPGSIZE-1) & ~(MEGAPGSIZE-1))
+#define MEGAPGROUNDDOWN(a) (((a)) & ~(MEGAPGSIZE-1))
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_G (1L << 5) // global mapping, present in every address space
+#define PTE_A (1L << 6) // accessed, set by the hardware
+#define PTE_D (1L << 7) // dirty, set by the hardware
+#define PTE_SWAP (1L << 8) // with PTE_V clear: the page is in swap, see swap.c
 #define PTE_COW (1L << 9) // copy-on-write page
 
 // shift a physical address to the right place for a PTE.
@@ -354,6 +390,10 @@ sfence_vma()
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a valid PTE with any of R/W/X set is a leaf; otherwise it points
+// to the next level page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
@@ -0,0 +1,47 @@
+#ifndef __SLAB_H
+#define __SLAB_H
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sysinfo.h"
+
+#define SLAB_MAG_SIZE    8    // 每个 hart 的 magazine 最多缓存的对象数
+#define SLAB_NAME_LEN   16
+
+// 每个 hart 私有的对象缓存（magazine），关中断访问，不需要加锁
+struct kmem_magazine {
+  int count;
+  void *objs[SLAB_MAG_SIZE];
+};
+
+// 一种固定大小对象的缓存。对象从一页大小的 slab 中切分出来，
+// 空闲对象保持"已构造"状态，因此构造函数只在 slab 创建时调用一次。
+struct kmem_cache {
+  char name[SLAB_NAME_LEN];
+  uint objsize;               // 用户请求的对象大小
+  uint stride;                // 对象在 slab 中占用的大小（含空闲链指针）
+  uint perslab;               // 每个 slab 可容纳的对象数
+  void (*ctor)(void *);       // 构造函数，可以为 NULL
+
+  struct spinlock lock;       // 保护下面的 slab 链表和统计
+  struct slab *partial;       // 还有空闲对象的 slab
+  struct slab *full;          // 已经分配满的 slab
+  struct slab *empty;         // 完全空闲的 slab（最多保留一个）
+
+  uint64 nslab;               // 当前 slab 页数
+  uint64 inuse;               // 已分配出去的对象数（含 magazine 之外的）
+  uint64 nalloc;              // 累计分配次数
+  uint64 maghit;              // 由 magazine 直接满足的分配次数
+
+  struct kmem_magazine mag[NCPU];
+  struct kmem_cache *next;    // 所有 cache 组成的链表，用于统计
+};
+
+void                kmem_cache_init(void);
+struct kmem_cache*  kmem_cache_create(char *name, uint size, void (*ctor)(void *));
+void*               kmem_cache_alloc(struct kmem_cache *cache);
+void                kmem_cache_free(struct kmem_cache *cache, void *obj);
+int                 kmem_cache_stats(struct slabinfo *info, int max);  // 结构定义见 sysinfo.h
+
+#endif
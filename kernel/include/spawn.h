@@ -0,0 +1,17 @@
+#ifndef __SPAWN_H
+#define __SPAWN_H
+
+// File actions applied to the child's descriptor table by spawn(),
+// in order, before the new program starts.
+#define SPAWN_DUP2   1  // newfd = dup of fd, closing newfd first
+#define SPAWN_CLOSE  2  // close fd
+
+#define SPAWN_MAXACT 8  // most actions per spawn() call
+
+struct spawn_action {
+  int op;     // SPAWN_DUP2 or SPAWN_CLOSE
+  int fd;
+  int newfd;  // SPAWN_DUP2 only
+};
+
+#endif
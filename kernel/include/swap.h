@@ -0,0 +1,26 @@
+#ifndef __SWAP_H
+#define __SWAP_H
+
+#include "types.h"
+#include "riscv.h"
+
+#define SWAPFILE "/swapfile"
+
+// A swapped-out PTE keeps its permission bits, has PTE_V clear and
+// PTE_SWAP set, and holds the slot number where the PPN used to be.
+#define PTE_SWAPPED(pte) (((pte) & (PTE_V | PTE_SWAP)) == PTE_SWAP)
+#define PTE2SLOT(pte)    ((int)((pte) >> 10))
+#define SLOT2PTE(slot)   ((uint64)(slot) << 10)
+
+struct proc;
+
+void            swapinit(void);
+int             swap_in(struct proc *p, uint64 va, pte_t *pte);
+void            swap_dup(pte_t pte);
+void            swap_free(pte_t pte);
+int             swap_reclaim(int n);
+int             swap_balance(void);
+void            swap_stat(uint64 *total, uint64 *used, uint64 *out, uint64 *in);
+void            swap_zstat(uint64 *out, uint64 *in);
+
+#endif
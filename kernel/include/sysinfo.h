@@ -2,10 +2,60 @@
 #define __SYSINFO_H
 
 #include "types.h"
+#include "param.h"
+
+// per-hart page cache statistics of kalloc
+struct pcpinfo {
+  uint64 hit;       // allocations served by the local cache
+  uint64 refill;    // batched refills from the global freelist
+  uint64 drain;     // batched returns to the global freelist
+  uint64 cached;    // pages currently held by the local cache
+};
+
+#define SYSINFO_NSLAB 16  // 最多导出的 slab cache 数
+
+// slab object cache statistics
+struct slabinfo {
+  char name[16];
+  uint64 objsize;
+  uint64 inuse;     // objects handed out
+  uint64 total;     // objects in all slabs
+  uint64 nslab;     // pages used by the cache
+  uint64 nalloc;    // total allocations
+  uint64 maghit;    // allocations served by the per-hart magazine
+};
 
 struct sysinfo {
   uint64 freemem;   // amount of free memory (bytes)
   uint64 nproc;     // number of process
+  struct pcpinfo pcp[NCPU];
+  uint64 nr_free[KMEM_MAX_ORDER + 1];   // free buddy blocks of each order
+  uint64 zcached;                       // pages in the pre-zeroed pool
+  uint64 zhit;                          // kalloc_zeroed() served by the pool
+  uint64 zmiss;                         // kalloc_zeroed() that had to memset
+  uint64 zpmapped;                      // PTEs mapping the shared zero page
+  uint64 cowcopy;                       // COW faults that copied the page
+  uint64 cowreuse;                      // COW faults by the last owner, no copy
+  uint64 cowzero;                       // COW faults that replaced the zero page
+  uint64 pcpages;                       // pages in the shared file page cache
+  uint64 pchit;                         // page cache lookups that found the page
+  uint64 pcmiss;                        // page cache lookups that read the file
+  uint64 swaptotal;                     // slots in the swap file
+  uint64 swapused;                      // slots holding a page
+  uint64 swapout;                       // pages written to swap
+  uint64 swapin;                        // pages read back from swap
+  uint64 zrampages;                     // pages held compressed in memory
+  uint64 zrambytes;                     // memory they take up
+  uint64 zramsame;                      // of those, same-filled pages
+  uint64 zramout;                       // pages compressed on swap-out
+  uint64 zramin;                        // pages decompressed on swap-in
+  uint64 ksmshared;                     // pages shared by same-page merging
+  uint64 ksmsaved;                      // extra mappings of them: pages saved
+  uint64 ksmscanned;                    // pages hashed by the scanner
+  uint64 ksmmerged;                     // pages merged into a shared page
+  uint64 ksmpasses;                     // full scans over all processes
+  uint64 nslab;                         // valid entries in slab[]
+  struct slabinfo slab[SYSINFO_NSLAB];
 };
 
 
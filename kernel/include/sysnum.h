@@ -44,5 +44,11 @@
 #define SYS_mmap         40  // Memory mapping
 #define SYS_munmap       41  // Unmap memory
 #define SYS_sandbox      42  // Seccomp-lite sandbox control
+#define SYS_faultaround  43  // Set the lazy fault-around window
+#define SYS_spawn        44  // Start a program in a new process
+#define SYS_ksm          45  // Switch same-page merging on or off
+#define SYS_madvise      46  // Advise the VM about a memory range
+#define SYS_mprotect     47  // Change the protection of a memory range
+#define SYS_msync        48  // Write back a shared file mapping
 
 #endif
\ No newline at end of file
@@ -4,33 +4,41 @@
 #include "types.h"
 #include "riscv.h"
 
+extern uint64   zero_page;
+
 void            kvminit(void);
 void            kvminithart(void);
 uint64          kvmpa(uint64);
 void            kvmmap(uint64, uint64, uint64, int);
 pte_t*          walk(pagetable_t, uint64, int);
+pte_t*          walksize(pagetable_t, uint64, int, uint64 *);
+int             megapage_split(pte_t *);
+int             mapmegapage(pagetable_t, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
-// void            uvminit(pagetable_t, uchar *, uint);
-void            uvminit(pagetable_t, pagetable_t, uchar *, uint);
-uint64          uvmalloc(pagetable_t, pagetable_t, uint64, uint64);
-uint64          uvmdealloc(pagetable_t, pagetable_t, uint64, uint64);
-// int             uvmcopy(pagetable_t, pagetable_t, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, pagetable_t, uint64);
+void            uvminit(pagetable_t, uchar *, uint);
+uint64          uvmalloc(pagetable_t, uint64, uint64);
+uint64          uvmdealloc(pagetable_t, uint64, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int shared);
 void            uvmfree(pagetable_t, uint64);
 // void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            vmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmprotect(pagetable_t pagetable, uint64 va, uint64 npages, int perm, int shared);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
-pagetable_t     proc_kpagetable(void);
-void            kvmfreeusr(pagetable_t kpt);
-void            kvmfree(pagetable_t kpagetable, int stack_free);
 uint64          kwalkaddr(pagetable_t pagetable, uint64 va);
 int             cow_alloc(pagetable_t pagetable, uint64 va);
-int             lazy_alloc(pagetable_t pagetable, pagetable_t kpagetable, uint64 va);
+void            cow_stat(uint64 *copy, uint64 *reuse, uint64 *zero);
+struct proc;
+struct vma;
+int             fault_around(struct proc *p, uint64 va, uint64 lo, uint64 hi, int perm, int write, struct vma *fv, int advice);
+int             uvmfault(struct proc *p, uint64 va, int write);
+int             fault_megapage(struct proc *p, uint64 va, uint64 lo, uint64 hi, int perm);
+int             uvmpopulate(struct proc *p, struct vma *v);
 void            uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free);
 int             is_cow_page(pagetable_t pagetable, uint64 va);
 int             copyout2(uint64 dstva, void *src, uint64 len);
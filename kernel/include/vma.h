@@ -11,12 +11,12 @@
 #include "types.h"
 #include "param.h"
 #include "spinlock.h"
-
-#define MAX_VMA 16  // 每个进程最多支持的 VMA 数量
+#include "riscv.h"
 
 /**
  * @brief mmap 保护标志
  */
+#define PROT_NONE   0x0  // 页不可访问
 #define PROT_READ   0x1  // 页可读
 #define PROT_WRITE  0x2  // 页可写
 #define PROT_EXEC   0x4  // 页可执行
@@ -28,6 +28,26 @@
 #define MAP_PRIVATE 0x02  // 私有映射（写时复制）
 #define MAP_FIXED   0x04  // 强制使用 addr，不解释为提示
 #define MAP_ANONYMOUS 0x08  // 匿名映射，不关联文件
+#define MAP_HUGETLB 0x10  // 尽量用 2 MiB megapage 映射（仅匿名映射）
+#define MAP_POPULATE 0x20  // mmap 返回前映射全部页面，文件映射同时读入
+#define MAP_NORESERVE 0x40  // 稀疏使用：写缺页只分配被访问的那一页
+#define MAP_HEAP    0x1000  // 内核内部：mprotect 为 sbrk 堆登记的 VMA
+
+/**
+ * @brief madvise 访问模式提示
+ */
+#define MADV_NORMAL     0  // 默认的 fault-around 窗口
+#define MADV_RANDOM     1  // 随机访问：每次缺页只映射一页
+#define MADV_SEQUENTIAL 2  // 顺序访问：从缺页处向后映射 / 预读最大窗口
+#define MADV_WILLNEED   3  // 马上要用：预先读入文件页、换入交换出去的页
+#define MADV_DONTNEED   4  // 不再需要：立即释放，再访问时重新缺页
+
+/**
+ * @brief msync 标志
+ */
+#define MS_ASYNC        1  // 发起写回（这里与 MS_SYNC 相同，同步完成）
+#define MS_INVALIDATE   2  // 其他映射看到写回后的内容（共享页本来就是同一页）
+#define MS_SYNC         4  // 写回完成后再返回
 
 /**
  * @brief Virtual Memory Area 结构体
@@ -38,31 +58,57 @@ struct vma {
     uint64 addr;      /* 起始虚拟地址（页对齐） */
     uint64 length;    /* 区域长度（字节） */
     uint64 offset;    /* 文件偏移量（文件映射使用） */
+    uint64 filesz;    /* 从文件读入的字节数，其余部分填零（如 bss） */
     int prot;         /* 保护标志（PROT_READ/WRITE/EXEC） */
     int flags;        /* 映射标志（MAP_SHARED/PRIVATE等） */
+    int advice;       /* madvise 访问模式（MADV_NORMAL/RANDOM/SEQUENTIAL） */
     struct file *f;   /* 关联的文件（NULL 表示匿名映射） */
-    int used;         /* 标记是否使用 */
+    struct vma *next; /* 按地址升序排列的下一个 VMA */
+    struct vma *prev; /* 按地址升序排列的上一个 VMA */
+    struct vma *left, *right;  /* AVL 树中的子节点，以 addr 为键 */
+    int height;       /* 以本节点为根的子树高度 */
+    uint64 gap;       /* 与上一个 VMA（或 PGSIZE）之间空洞的大小 */
+    uint64 maxgap;    /* 子树中最大的 gap，用于查找空闲范围 */
 };
 
 /**
  * @brief 进程的 VMA 管理器
+ *
+ * VMA 节点从 slab 中分配，数量不受限制。节点同时在按地址排序的双向
+ * 链表和一棵 AVL 树中：链表用于顺序遍历，树用于 O(log n) 的查找和
+ * 空闲范围搜索。cache 记住最近一次查找命中的 VMA，缺页通常落在同一区域
  */
 struct vma_manager {
-    struct spinlock lock;     /* 保护 VMA 列表的锁 */
-    struct vma vmas[MAX_VMA]; /* VMA 数组 */
+    struct spinlock lock;     /* 保护 VMA 链表、树和 cache 的锁 */
+    struct vma *head;         /* 按地址升序排列的 VMA 链表 */
+    struct vma *root;         /* AVL 树的根 */
+    struct vma *cache;        /* 最近一次 vma_lookup() 命中的 VMA */
     int count;                /* 当前 VMA 数量 */
 };
 
 /* VMA 管理函数 */
+void vmainit(void);
 void vma_init(struct vma_manager *vmam);
-struct vma* vma_alloc(struct vma_manager *vmam);
-void vma_free(struct vma_manager *vmam, struct vma *vma);
 struct vma* vma_lookup(struct vma_manager *vmam, uint64 addr);
 int vma_insert(struct vma_manager *vmam, uint64 addr, uint64 length,
-               uint64 offset, int prot, int flags, struct file *f);
+               uint64 offset, uint64 filesz, int prot, int flags,
+               struct file *f);
 int vma_remove(struct vma_manager *vmam, uint64 addr, uint64 length);
-void vma_copy(struct vma_manager *dst, struct vma_manager *src);
+int vma_copy(struct vma_manager *dst, struct vma_manager *src);
+int vma_fork(struct vma_manager *vmam, pagetable_t old, pagetable_t new, uint64 sz);
 void vma_cleanup(struct vma_manager *vmam);
+void vma_unmapall(struct vma_manager *vmam, pagetable_t pagetable);
+struct proc;
+int vma_writeback(struct proc *p, pagetable_t pagetable, struct vma *v,
+                  uint64 start, uint64 end);
+void vma_move(struct vma_manager *dst, struct vma_manager *src);
+uint64 vma_cachedpage(struct vma *vma, uint64 va);
+int vma_readpage(struct vma *vma, uint64 va, char *mem);
+void vma_hole(struct vma_manager *vmam, uint64 addr, uint64 *lo, uint64 *hi);
+int vma_split(struct vma_manager *vmam, uint64 addr);
+int vma_advise(struct vma_manager *vmam, uint64 addr, uint64 length, int advice);
+int vma_protect(struct vma_manager *vmam, uint64 addr, uint64 length, int prot);
+void vma_trimheap(struct vma_manager *vmam, uint64 sz);
 int vma_find_free_range(struct vma_manager *vmam, uint64 hint_addr,
                         uint64 length, uint64 *result);
 
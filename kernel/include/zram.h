@@ -0,0 +1,19 @@
+#ifndef __ZRAM_H
+#define __ZRAM_H
+
+#include "types.h"
+
+// A page held compressed in RAM.
+struct zpage {
+  uint64 v;               // the compressed data, or the fill word if len == 0
+  ushort len;             // compressed length, 0 for a same-filled page
+  uchar cls;              // size class of the object holding the data
+};
+
+void            zraminit(void);
+int             zram_store(char *page, struct zpage *zp);
+void            zram_load(struct zpage *zp, char *page);
+void            zram_free(struct zpage *zp);
+void            zram_stat(uint64 *npages, uint64 *bytes, uint64 *same);
+
+#endif
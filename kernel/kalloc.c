@@ -1,6 +1,7 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous blocks of 2^order pages.
 
 
 #include "include/types.h"
@@ -11,27 +12,75 @@
 #include "include/kalloc.h"
 #include "include/string.h"
 #include "include/printf.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/fdt.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char kernel_end[]; // first address after kernel.
 
+uint64 phystop = PHYSTOP_DEFAULT;   // 物理内存上界，kinit() 中确定
+
 struct run {
   struct run *next;
 };
 
-struct {
+// 伙伴系统（buddy system）管理的空闲块。空闲块的头部复用块本身的内存，
+// 使用双向链表以便在合并时把伙伴块从链表中间摘除。
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
+#define ORDER_NONE  0xff      // page_order[] 中表示"不是空闲块的首页"
+
+// 每个 hart 私有的单页缓存。kalloc()/kfree() 优先在本地缓存上操作，
+// 只有缓存空了（批量补充）或攒满了（批量归还）才会去碰伙伴系统的 kmem.lock。
+// 本地锁只在本 hart 内部使用，别的 hart 只有在内存耗尽需要"偷页"时才会获取它。
+#define KMEM_PCP_BATCH  16    // 每次批量补充/归还的页数
+#define KMEM_PCP_HIGH   64    // 本地缓存页数上限，超过后归还一批
+
+struct kmem_pcp {
   struct spinlock lock;
   struct run *freelist;
-  uint64 npage;
-} kmem;
+  int count;            // 本地缓存中的页数
+  uint64 hit;           // 直接从本地缓存满足的分配次数
+  uint64 refill;        // 从伙伴系统批量补充的次数
+  uint64 drain;         // 向伙伴系统批量归还的次数
+};
 
-// 写时复制的页引用计数
-#define MAX_PAGE_COUNT ((PHYSTOP - KERNBASE) / PGSIZE)
+// 预先清零的页面池。scheduler() 没有可运行进程时调用 kmem_prezero()
+// 往池中补充清零的页，kalloc_zeroed() 优先从池中取，省掉缺页路径上的 memset。
+// 池中的页引用计数保持为 1，链表指针占用页首 8 字节，取出时再清掉。
+#define KMEM_ZERO_HIGH  32    // 池中最多保留的页数
 
 struct {
   struct spinlock lock;
-  int ref_count[MAX_PAGE_COUNT];
+  struct run *list;
+  int count;
+  uint64 hit;           // 由池直接满足的 kalloc_zeroed() 次数
+  uint64 miss;          // 池为空、需要当场清零的次数
+} zpool;
+
+// 每页元数据（page_order[] 和 ref_count[]）按 KERNBASE 到 PHYSTOP 的页数
+// 在 kinit() 中从内核之后的空闲内存里划出，大小随实际内存变化
+#define MAX_PAGE_COUNT  kmem.maxpage
+
+struct {
+  struct spinlock lock;
+  struct block free_area[KMEM_MAX_ORDER + 1];   // 每个阶一条空闲链表（带哨兵）
+  uint64 nr_free[KMEM_MAX_ORDER + 1];           // 每个阶的空闲块数
+  uint8 *page_order;                            // 空闲块首页记录其阶，其余为 ORDER_NONE
+  uint64 base;                                  // 伙伴系统管理的第一个物理页
+  uint64 npage;
+  int maxpage;                                  // KERNBASE 到 PHYSTOP 的页数
+  struct kmem_pcp pcp[NCPU];
+} kmem;
+
+// 物理页引用计数，用 AMO 原子指令更新，不需要加锁
+struct {
+  int *ref_count;
 } page_ref;
 
 static inline int
@@ -46,55 +95,172 @@ index2pa(int index)
   return KERNBASE + index * PGSIZE;
 }
 
+static inline void
+block_insert(int order, uint64 pa)
+{
+  struct block *b = (struct block *)pa;
+  struct block *head = &kmem.free_area[order];
+
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+  kmem.page_order[pa2index(pa)] = order;
+  kmem.nr_free[order]++;
+}
+
+static inline void
+block_remove(int order, uint64 pa)
+{
+  struct block *b = (struct block *)pa;
+
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  kmem.page_order[pa2index(pa)] = ORDER_NONE;
+  kmem.nr_free[order]--;
+}
+
+// 从伙伴系统中取出一个 2^order 页的块，必要时拆分更大的块。
+// 调用者持有 kmem.lock。
+static uint64
+buddy_alloc(int order)
+{
+  int k;
+
+  for (k = order; k <= KMEM_MAX_ORDER; k++) {
+    if (kmem.free_area[k].next != &kmem.free_area[k])
+      break;
+  }
+  if (k > KMEM_MAX_ORDER)
+    return 0;
+
+  uint64 pa = (uint64)kmem.free_area[k].next;
+  block_remove(k, pa);
+  // 把多余的后半部分依次挂回低阶链表
+  while (k > order) {
+    k--;
+    block_insert(k, pa + ((uint64)PGSIZE << k));
+  }
+  kmem.npage -= 1UL << order;
+  return pa;
+}
+
+// 把一个 2^order 页的块还给伙伴系统，并尽可能与伙伴块合并。
+// 调用者持有 kmem.lock。
+static void
+buddy_free(uint64 pa, int order)
+{
+  kmem.npage += 1UL << order;
+  while (order < KMEM_MAX_ORDER) {
+    uint64 buddy = pa ^ ((uint64)PGSIZE << order);
+    if (buddy < kmem.base || buddy + ((uint64)PGSIZE << order) > PHYSTOP)
+      break;
+    if (kmem.page_order[pa2index(buddy)] != order)
+      break;
+    block_remove(order, buddy);
+    if (buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  block_insert(order, pa);
+}
+
+// 原子地将引用计数减一并返回新值（amoadd.w）。
+// 计数本来就是 0 时（例如从未经 kalloc 分配的页）恢复为 0 并返回 0。
+static int
+ref_dec_and_test(int idx)
+{
+  int ref = __sync_sub_and_fetch(&page_ref.ref_count[idx], 1);
+  if (ref < 0) {
+    __sync_fetch_and_add(&page_ref.ref_count[idx], 1);
+    return 0;
+  }
+  return ref;
+}
+
 // 增加物理页的引用计数
 void incref(uint64 pa)
 {
-  acquire(&page_ref.lock);
   int idx = pa2index(pa);
   if (idx >= 0 && idx < MAX_PAGE_COUNT) {
-    page_ref.ref_count[idx]++;
+    __sync_fetch_and_add(&page_ref.ref_count[idx], 1);
   }
-  release(&page_ref.lock);
 }
 
 //减少物理页的引用计数
 void decref(uint64 pa)
 {
-  acquire(&page_ref.lock);
   int idx = pa2index(pa);
   if (idx >= 0 && idx < MAX_PAGE_COUNT) {
-    if (page_ref.ref_count[idx] > 0) {
-      page_ref.ref_count[idx]--;
-    }
+    ref_dec_and_test(idx);
   }
-  release(&page_ref.lock);
 }
 
 // 获取物理页的引用计数
 int getref(uint64 pa)
 {
-  int ref = 0;
-  acquire(&page_ref.lock);
   int idx = pa2index(pa);
   if (idx >= 0 && idx < MAX_PAGE_COUNT) {
-    ref = page_ref.ref_count[idx];
+    return __atomic_load_n(&page_ref.ref_count[idx], __ATOMIC_RELAXED);
   }
-  release(&page_ref.lock);
-  return ref;
+  return 0;
+}
+
+// 确定物理内存上界：QEMU 上从设备树中找到包含内核的内存区间；
+// k210 的 RustSBI 不保证传入有效的 DTB，直接使用 PHYSTOP_DEFAULT。
+// DTB 本身不做保留：它只在这里读一次，之后和其他空闲内存一起交给分配器。
+static void
+phys_detect(uint64 dtb_pa)
+{
+  #ifdef QEMU
+  uint64 base, size;
+  if (fdt_memory(dtb_pa, KERNBASE, &base, &size) == 0)
+    phystop = PGROUNDDOWN(base + size);
+  #endif
 }
 
 void
-kinit()
+kinit(uint64 dtb_pa)
 {
+  uint64 start;
+
+  phys_detect(dtb_pa);
+
+  // 在内核之后划出每页元数据，伙伴系统从元数据之后开始管理
+  kmem.maxpage = (phystop - KERNBASE) / PGSIZE;
+  start = PGROUNDUP((uint64)kernel_end);
+  page_ref.ref_count = (int *)start;
+  start += kmem.maxpage * sizeof(int);
+  kmem.page_order = (uint8 *)start;
+  start += kmem.maxpage;
+
   initlock(&kmem.lock, "kmem");
-  initlock(&page_ref.lock, "page_ref");
-  kmem.freelist = 0;
+  for (int k = 0; k <= KMEM_MAX_ORDER; k++) {
+    kmem.free_area[k].next = kmem.free_area[k].prev = &kmem.free_area[k];
+    kmem.nr_free[k] = 0;
+  }
+  for (int i = 0; i < MAX_PAGE_COUNT; i++)
+    kmem.page_order[i] = ORDER_NONE;
+  kmem.base = PGROUNDUP(start);
   kmem.npage = 0;
+  for (int i = 0; i < NCPU; i++) {
+    initlock(&kmem.pcp[i].lock, "kmem_pcp");
+    kmem.pcp[i].freelist = 0;
+    kmem.pcp[i].count = 0;
+    kmem.pcp[i].hit = 0;
+    kmem.pcp[i].refill = 0;
+    kmem.pcp[i].drain = 0;
+  }
+  initlock(&zpool.lock, "zpool");
+  zpool.list = NULL;
+  zpool.count = 0;
  // 将引用计数初始化为0
   for (int i = 0; i < MAX_PAGE_COUNT; i++) {
     page_ref.ref_count[i] = 0;
   }
-  freerange(kernel_end, (void*)PHYSTOP);
+  acquire(&kmem.lock);
+  freerange((void*)kmem.base, (void*)PHYSTOP);
+  release(&kmem.lock);
   #ifdef DEBUG
   printf("kernel_end: %p, phystop: %p\n", kernel_end, (void*)PHYSTOP);
   printf("kinit\n");
@@ -107,7 +273,76 @@ freerange(void *pa_start, void *pa_end)
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
   for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+    buddy_free((uint64)p, 0);
+}
+
+// 从伙伴系统批量取出最多 n 个单页放入本地缓存。
+// 调用者持有 pcp->lock。
+static void
+pcp_refill(struct kmem_pcp *pcp, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  if (kmem.npage > 0)
+    pcp->refill++;
+  for (; n > 0 && (r = (struct run *)buddy_alloc(0)) != NULL; n--) {
+    r->next = pcp->freelist;
+    pcp->freelist = r;
+    pcp->count++;
+  }
+  release(&kmem.lock);
+}
+
+// 把本地缓存中的 n 页归还给伙伴系统。
+// 调用者持有 pcp->lock。
+static void
+pcp_drain(struct kmem_pcp *pcp, int n)
+{
+  struct run *r;
+
+  pcp->drain++;
+  acquire(&kmem.lock);
+  for (; n > 0 && (r = pcp->freelist) != NULL; n--) {
+    pcp->freelist = r->next;
+    pcp->count--;
+    buddy_free((uint64)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// 伙伴系统耗尽时，从其他 hart 的本地缓存中取一页。
+// 一次只持有一把 pcp 锁，不会与 kalloc()/kfree() 形成死锁。
+static struct run *
+pcp_steal(void)
+{
+  struct run *r = NULL;
+
+  for (int i = 0; i < NCPU && r == NULL; i++) {
+    struct kmem_pcp *pcp = &kmem.pcp[i];
+    acquire(&pcp->lock);
+    if ((r = pcp->freelist) != NULL) {
+      pcp->freelist = r->next;
+      pcp->count--;
+    }
+    release(&pcp->lock);
+  }
+  return r;
+}
+
+// 从预清零池中取出一页，页内容除首 8 字节外都是 0。
+static struct run *
+zpool_take(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  if ((r = zpool.list) != NULL) {
+    zpool.list = r->next;
+    zpool.count--;
+  }
+  release(&zpool.lock);
+  return r;
 }
 
 // Free the page of physical memory pointed at by v,
@@ -119,34 +354,36 @@ kfree(void *pa)
 {
   struct run *r;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < kernel_end || (uint64)pa >= PHYSTOP)
+  if(((uint64)pa % PGSIZE) != 0 || (uint64)pa < kmem.base || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
-// 减少引用计数，仅当计数归零时释放页面
-  acquire(&page_ref.lock);
+  // 原子地减少引用计数，仅当计数归零时释放页面。
+  // 只有把计数减到 0 的那一方会走到下面，因此不会重复释放。
   int idx = pa2index((uint64)pa);
   if (idx >= 0 && idx < MAX_PAGE_COUNT) {
-    if (page_ref.ref_count[idx] > 0) {
-      page_ref.ref_count[idx]--;
-    }
-    if (page_ref.ref_count[idx] > 0) {
+    if (ref_dec_and_test(idx) > 0) {
       // 页面仍被引用，暂不实际释放
-      release(&page_ref.lock);
       return;
     }
   }
-  release(&page_ref.lock);
 
+  #ifdef DEBUG
   // 用随机垃圾数据填充，用来尽早暴露悬空引用（dangling refs）的错误。
   memset(pa, 1, PGSIZE);
+  #endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  kmem.npage++;
-  release(&kmem.lock);
+  push_off();
+  struct kmem_pcp *pcp = &kmem.pcp[cpuid()];
+  acquire(&pcp->lock);
+  r->next = pcp->freelist;
+  pcp->freelist = r;
+  pcp->count++;
+  if (pcp->count >= KMEM_PCP_HIGH)
+    pcp_drain(pcp, KMEM_PCP_BATCH);
+  release(&pcp->lock);
+  pop_off();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -157,23 +394,38 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r) {
-    kmem.freelist = r->next;
-    kmem.npage--;
+  push_off();
+  struct kmem_pcp *pcp = &kmem.pcp[cpuid()];
+  acquire(&pcp->lock);
+  if (pcp->freelist)
+    pcp->hit++;
+  else
+    pcp_refill(pcp, KMEM_PCP_BATCH);
+  r = pcp->freelist;
+  if (r) {
+    pcp->freelist = r->next;
+    pcp->count--;
   }
-  release(&kmem.lock);
+  release(&pcp->lock);
+  pop_off();
+
+  // 伙伴系统也空了，最后再看看其他 hart 的缓存里有没有剩余
+  if (r == NULL)
+    r = pcp_steal();
+
+  // 预清零池中的页也是空闲页，内存紧张时同样可以拿来用
+  if (r == NULL)
+    r = zpool_take();
 
   if(r) {
+    #ifdef DEBUG
     memset((char*)r, 5, PGSIZE); // fill with junk
-    // 将引用计数初始化为1
-    acquire(&page_ref.lock);
+    #endif
+    // 将引用计数初始化为1，页面此时只属于调用者，直接写入即可
     int idx = pa2index((uint64)r);
     if (idx >= 0 && idx < MAX_PAGE_COUNT) {
-      page_ref.ref_count[idx] = 1;
+      __atomic_store_n(&page_ref.ref_count[idx], 1, __ATOMIC_RELEASE);
     }
-    release(&page_ref.lock);
   }
   return (void*)r;
 }
@@ -181,5 +433,155 @@ kalloc(void)
 uint64
 freemem_amount(void)
 {
-  return kmem.npage << PGSHIFT;
+  uint64 n = kmem.npage + zpool.count;
+  for (int i = 0; i < NCPU; i++)
+    n += kmem.pcp[i].count;
+  return n << PGSHIFT;
+}
+
+// 分配一页内容全为 0 的物理页。
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r = zpool_take();
+
+  if (r != NULL) {
+    r->next = NULL;   // 清掉链表指针，整页恢复为 0
+    __sync_fetch_and_add(&zpool.hit, 1);
+    return (void*)r;
+  }
+
+  __sync_fetch_and_add(&zpool.miss, 1);
+  if ((r = kalloc()) != NULL)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// 往预清零池中补充至多 n 页，返回本次清零的页数。
+// 由空闲的 hart 在 scheduler() 中调用，返回 0 表示池已满或内存不足。
+int
+kmem_prezero(int n)
+{
+  int done = 0;
+
+  while (done < n && zpool.count < KMEM_ZERO_HIGH) {
+    struct run *r = kalloc();
+    if (r == NULL)
+      break;
+    memset((char*)r, 0, PGSIZE);
+    acquire(&zpool.lock);
+    r->next = zpool.list;
+    zpool.list = r;
+    zpool.count++;
+    release(&zpool.lock);
+    done++;
+  }
+  return done;
+}
+
+// 读取预清零池的统计信息，不加锁读取，仅供参考
+void
+kmem_zerostat(uint64 *cached, uint64 *hit, uint64 *miss)
+{
+  *cached = zpool.count;
+  *hit = zpool.hit;
+  *miss = zpool.miss;
+}
+
+// 读取某个 hart 的页缓存统计信息，统计值不加锁读取，仅供参考
+void
+kmem_pcpstat(int cpu, uint64 *hit, uint64 *refill, uint64 *drain, uint64 *cached)
+{
+  struct kmem_pcp *pcp = &kmem.pcp[cpu];
+  *hit = pcp->hit;
+  *refill = pcp->refill;
+  *drain = pcp->drain;
+  *cached = pcp->count;
+}
+
+// 分配 2^order 个物理连续的页，块首地址按块大小对齐。
+// 每一页的引用计数都初始化为 1，因此也可以逐页 kfree()。
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_pages(int order)
+{
+  uint64 pa;
+
+  if (order < 0 || order > KMEM_MAX_ORDER)
+    return NULL;
+  if (order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  pa = buddy_alloc(order);
+  release(&kmem.lock);
+  if (pa == 0)
+    return NULL;
+
+  #ifdef DEBUG
+  memset((char*)pa, 5, (uint64)PGSIZE << order); // fill with junk
+  #endif
+  for (int i = 0; i < (1 << order); i++)
+    __atomic_store_n(&page_ref.ref_count[pa2index(pa) + i], 1, __ATOMIC_RELEASE);
+  return (void*)pa;
+}
+
+// 释放由 kalloc_pages(order) 分配的块。
+// 块内每页的引用计数减一；若全部归零则整块归还并合并，
+// 否则只逐页释放那些已经没有引用的页。
+void
+kfree_pages(void *pa, int order)
+{
+  uint64 start = (uint64)pa;
+  int npages = 1 << order;
+  int allfree = 1;
+  uint64 zero[(1 << KMEM_MAX_ORDER) / 64] = {0};   // 本次减到 0 的页
+
+  if (order < 0 || order > KMEM_MAX_ORDER)
+    panic("kfree_pages: order");
+  if (order == 0) {
+    kfree(pa);
+    return;
+  }
+  if ((start % ((uint64)PGSIZE << order)) != 0 || start < kmem.base ||
+      start + ((uint64)PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  for (int i = 0; i < npages; i++) {
+    if (ref_dec_and_test(pa2index(start) + i) > 0)
+      allfree = 0;
+    else
+      zero[i / 64] |= 1UL << (i % 64);
+  }
+
+  if (!allfree) {
+    // 部分页仍被引用（例如被 fork 共享），只释放本次减到 0 的页，
+    // 其余的页由最后一个持有者通过 kfree() 释放
+    for (int i = 0; i < npages; i++) {
+      uint64 p = start + (uint64)i * PGSIZE;
+      if (zero[i / 64] & (1UL << (i % 64))) {
+        incref(p);
+        kfree((void*)p);
+      }
+    }
+    return;
+  }
+
+  #ifdef DEBUG
+  memset(pa, 1, (uint64)PGSIZE << order);
+  #endif
+  acquire(&kmem.lock);
+  buddy_free(start, order);
+  release(&kmem.lock);
+}
+
+// 读取伙伴系统各阶空闲块数量，用于计算碎片化程度
+void
+kmem_buddystat(uint64 *nr_free)
+{
+  acquire(&kmem.lock);
+  for (int k = 0; k <= KMEM_MAX_ORDER; k++)
+    nr_free[k] = kmem.nr_free[k];
+  release(&kmem.lock);
 }
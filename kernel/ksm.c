@@ -0,0 +1,261 @@
+// Kernel same-page merging.
+//
+// When ksm(1) has switched it on, the scheduler's idle loop calls
+// ksm_scan(), which walks the page tables of processes that are not
+// running, at most KSM_BATCH pages per clock tick, and hashes each
+// private anonymous page. Two tables drive the merging:
+//
+//   unstable  hashes of the pages seen so far in this pass. It is
+//             only a hint and is cleared at the start of every pass.
+//   stable    pages already shared by KSM. Each is mapped read-only
+//             with PTE_COW by everyone and KSM holds one reference
+//             of its own, so a write copies it as usual.
+//
+// A page whose hash is in the stable table and whose contents match
+// is merged: its PTE is pointed at the stable page and it is freed.
+// A page whose hash is only in the unstable table becomes a stable
+// page itself; its twin is merged when the scanner comes to it.
+// Stable pages that only KSM still references are dropped.
+//
+// Only one process lock is held at a time, and only while q cannot
+// run. As in swap.c, a process stopped in the middle of editing its
+// page table (p->vmbusy) is skipped: it may be about to make a page
+// it found to be its own alone writable again.
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/memlayout.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/proc.h"
+#include "include/kalloc.h"
+#include "include/vm.h"
+#include "include/vma.h"
+#include "include/asid.h"
+#include "include/timer.h"
+#include "include/string.h"
+#include "include/ksm.h"
+
+extern struct proc proc[NPROC];
+
+struct stable {
+  uint64 hash;
+  uint64 pa;                    // 0 if the entry is free
+};
+
+static struct {
+  struct spinlock lock;         // protects everything below
+  int on;
+  int scanning;                 // a hart is inside ksm_scan()
+  uint lasttick;                // tick of the last batch
+  int hand;                     // cursor: index into proc[]
+  uint64 handva;                // and the next address to look at
+  uint64 unstable[KSM_UNSTABLE];
+  struct stable stable[KSM_STABLE];
+  uint64 nscan;                 // pages hashed
+  uint64 nmerge;                // pages merged into a stable page
+  uint64 npass;                 // full passes over proc[]
+} ksm;
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+}
+
+// FNV-1a over the page's words.
+static uint64
+pagehash(uint64 pa)
+{
+  uint64 *w = (uint64*)pa, h = 14695981039346656037ull;
+
+  for(int i = 0; i < PGSIZE / sizeof(uint64); i++)
+    h = (h ^ w[i]) * 1099511628211ull;
+  return h;
+}
+
+static struct stable *
+stable_find(uint64 hash, uint64 pa)
+{
+  for(struct stable *s = ksm.stable; s < &ksm.stable[KSM_STABLE]; s++)
+    if(s->pa && s->hash == hash && memcmp((void*)s->pa, (void*)pa, PGSIZE) == 0)
+      return s;
+  return 0;
+}
+
+// Drop stable pages nobody maps any more.
+// Caller holds ksm.lock.
+static void
+stable_prune(void)
+{
+  for(struct stable *s = ksm.stable; s < &ksm.stable[KSM_STABLE]; s++){
+    if(s->pa && getref(s->pa) == 1){
+      kfree((void*)s->pa);
+      s->pa = 0;
+    }
+  }
+}
+
+static struct stable *
+stable_alloc(void)
+{
+  for(struct stable *s = ksm.stable; s < &ksm.stable[KSM_STABLE]; s++)
+    if(s->pa == 0)
+      return s;
+  return 0;
+}
+
+// Look at the page of q mapped by *pte at va. Returns 1 if it was
+// hashed, 0 if it is not a candidate.
+// Caller holds ksm.lock and q->lock, and q is not running and not
+// editing its page table.
+static int
+ksm_page(struct proc *q, uint64 va, pte_t *pte)
+{
+  pte_t e = *pte;
+  uint64 pa, h;
+  struct vma *vma;
+  struct stable *s;
+
+  // private anonymous pages only: writable, or COW and ours alone
+  if((e & PTE_V) == 0 || (e & PTE_U) == 0 || (e & (PTE_W | PTE_COW)) == 0)
+    return 0;
+  pa = PTE2PA(e);
+  if(pa == zero_page || getref(pa) != 1)
+    return 0;
+  vma = vma_lookup(&q->vma_manager, va);
+  if(vma && (vma->flags & MAP_SHARED))
+    return 0;
+
+  h = pagehash(pa);
+  ksm.nscan++;
+  if((s = stable_find(h, pa)) != 0){
+    incref(s->pa);
+    *pte = PA2PTE(s->pa) | ((PTE_FLAGS(e) & ~PTE_W) | PTE_COW);
+    asid_invalidate(q);
+    kfree((void*)pa);
+    ksm.nmerge++;
+    return 1;
+  }
+
+  uint64 *u = &ksm.unstable[h % KSM_UNSTABLE];
+  if(*u != h){
+    *u = h;
+    return 1;
+  }
+  // seen this content before in this pass: share this copy
+  if((s = stable_alloc()) == 0){
+    stable_prune();
+    if((s = stable_alloc()) == 0)
+      return 1;
+  }
+  incref(pa);                   // KSM's own reference
+  s->hash = h;
+  s->pa = pa;
+  *pte = (e & ~PTE_W) | PTE_COW;
+  asid_invalidate(q);
+  *u = 0;
+  return 1;
+}
+
+// Scan at most n pages of q from ksm.handva on; ksm.handva is MAXUVA
+// once q has been scanned completely. Returns the pages hashed.
+static int
+ksm_scanproc(struct proc *q, int n)
+{
+  int nhash = 0, nlook = 0;
+  uint64 va, size;
+  pte_t *pte;
+
+  for(va = ksm.handva; va < MAXUVA && nhash < n && nlook < n * 64; va += PGSIZE){
+    nlook++;
+    pte = walksize(q->pagetable, va, 0, &size);
+    if(pte == 0 || size == MEGAPGSIZE){
+      va = MEGAPGROUNDDOWN(va) + MEGAPGSIZE - PGSIZE;
+      continue;                 // no level-0 table here
+    }
+    nhash += ksm_page(q, va, pte);
+  }
+  ksm.handva = va;
+  return nhash;
+}
+
+// Called from the scheduler's idle loop. Hashes at most KSM_BATCH
+// pages, and only once per tick. Returns the pages hashed.
+int
+ksm_scan(void)
+{
+  int n = 0;
+
+  if(!ksm.on || ksm.lasttick == ticks)
+    return 0;
+  if(__sync_lock_test_and_set(&ksm.scanning, 1))
+    return 0;                   // another idle hart is at it
+
+  acquire(&ksm.lock);
+  ksm.lasttick = ticks;
+  for(int i = 0; i <= NPROC && n < KSM_BATCH; i++){
+    struct proc *q = &proc[ksm.hand];
+    acquire(&q->lock);
+    if(q->pagetable != 0 && q->vmbusy == 0 &&
+       (q->state == RUNNABLE || q->state == SLEEPING))
+      n += ksm_scanproc(q, KSM_BATCH - n);
+    else
+      ksm.handva = MAXUVA;
+    release(&q->lock);
+    if(ksm.handva < MAXUVA)
+      break;                    // q has more, go on next tick
+    ksm.handva = 0;
+    if(++ksm.hand == NPROC){
+      ksm.hand = 0;
+      ksm.npass++;
+      memset(ksm.unstable, 0, sizeof(ksm.unstable));
+      stable_prune();
+    }
+  }
+  release(&ksm.lock);
+  __sync_lock_release(&ksm.scanning);
+  return n;
+}
+
+// Switch the scanner on (1) or off (0); a negative value only
+// queries. Returns the previous setting. Pages already merged stay
+// shared until they are written.
+int
+ksm_set(int on)
+{
+  int old;
+
+  acquire(&ksm.lock);
+  old = ksm.on;
+  if(on >= 0)
+    ksm.on = on != 0;
+  if(on == 0)
+    stable_prune();
+  release(&ksm.lock);
+  return old;
+}
+
+// shared: stable pages; saved: the mappings of them beyond the first,
+// i.e. the pages merging has freed right now.
+void
+ksm_stat(uint64 *shared, uint64 *saved, uint64 *scanned, uint64 *merged,
+         uint64 *passes)
+{
+  uint64 n = 0, sv = 0;
+
+  acquire(&ksm.lock);
+  for(struct stable *s = ksm.stable; s < &ksm.stable[KSM_STABLE]; s++){
+    int ref = s->pa ? getref(s->pa) : 0;
+    if(ref > 1){
+      n++;
+      sv += ref - 2;
+    }
+  }
+  *shared = n;
+  *saved = sv;
+  *scanned = ksm.nscan;
+  *merged = ksm.nmerge;
+  *passes = ksm.npass;
+  release(&ksm.lock);
+}
@@ -17,9 +17,16 @@
 #include "include/disk.h"
 #include "include/buf.h"
 #include "include/defs.h"
+#include "include/slab.h"
+#include "include/asid.h"
+#include "include/pagecache.h"
+#include "include/zram.h"
+#include "include/ksm.h"
 
 // 共享内存初始化函数
 void shm_init(void);
+// VMA 节点缓存初始化函数
+void vmainit(void);
 
 #ifndef QEMU
 #include "include/sdcard.h"
@@ -46,9 +53,11 @@ main(unsigned long hartid, unsigned long dtb_pa)
     #ifdef DEBUG
     printf("hart %d enter main()...\n", hartid);
     #endif
-    kinit();         // physical page allocator
+    kinit(dtb_pa);   // physical page allocator
+    kmem_cache_init(); // slab object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // probe hardware ASID support
     timerinit();     // init a lock for timer
     trapinithart();  // install kernel trap vector, including interrupt handler
     procinit();
@@ -61,6 +70,11 @@ main(unsigned long hartid, unsigned long dtb_pa)
     disk_init();
     binit();         // buffer cache
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    vmainit();       // vma cache
+    pcacheinit();    // shared file page cache
+    zraminit();      // compressed swap store
+    ksminit();       // same-page merging
     shm_init();      // shared memory
     userinit();      // first user process
     printf("hart 0 init done\n");
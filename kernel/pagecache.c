@@ -0,0 +1,295 @@
+// Shared cache of file pages.
+//
+// Private file mappings, exec's program segments in particular, map
+// their pages straight from this cache, read-only or COW, so every
+// process running the same binary shares one copy of its text.
+// MAP_SHARED file mappings map the cached page writable: all of their
+// mappers share it, and dirty pages are written back by msync(),
+// munmap() and exit (see vma_writeback()). A page handed out to a
+// shared mapping is marked shared.
+// A page is identified by its dirent, the file offset of its first
+// byte and the number of bytes that come from the file; the rest of
+// the page is zero (e.g. where .data meets .bss).
+//
+// The cache holds one reference on each page through kalloc's page
+// refcount and the mappings hold the others, so a cached page is
+// never written in place through a private mapping: cow_alloc() sees
+// the extra reference and copies. When the file is written, its
+// private pages are dropped and its shared pages are updated from the
+// file instead, so shared mappers keep seeing one copy. All pages of
+// a file are dropped when it is truncated or when its dirent is
+// recycled for another file; once the cache is full, pages nobody
+// maps any more are evicted.
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/sleeplock.h"
+#include "include/fat32.h"
+#include "include/kalloc.h"
+#include "include/slab.h"
+#include "include/pagecache.h"
+
+#define NPCBUCKET 64
+
+struct cpage {
+  struct dirent *ep;
+  uint off;                 // file offset of the first byte
+  uint len;                 // bytes read from the file
+  int shared;               // mapped by a MAP_SHARED mapping
+  uint64 pa;
+  struct cpage *next;       // hash chain
+};
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct cpage *bucket[NPCBUCKET];
+  int npages;
+  int hand;                 // next bucket to look at for eviction
+  uint64 hit;
+  uint64 miss;
+} pcache;
+
+static inline int
+pchash(struct dirent *ep, uint off)
+{
+  return (((uint64)ep >> 6) ^ (off >> PGSHIFT)) % NPCBUCKET;
+}
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = kmem_cache_create("pcache", sizeof(struct cpage), 0);
+}
+
+// Caller holds pcache.lock.
+static struct cpage *
+pclookup(struct dirent *ep, uint off, uint len)
+{
+  struct cpage *cp;
+
+  for(cp = pcache.bucket[pchash(ep, off)]; cp; cp = cp->next)
+    if(cp->ep == ep && cp->off == off && cp->len == len)
+      return cp;
+  return 0;
+}
+
+// Unlink one page that only the cache refers to, sweeping the
+// buckets round-robin. Returns the node for the caller to free
+// outside the lock, or 0 if every cached page is mapped somewhere.
+// Caller holds pcache.lock.
+static struct cpage *
+pcevict(void)
+{
+  struct cpage *cp, **pp;
+
+  for(int i = 0; i < NPCBUCKET; i++){
+    int b = pcache.hand;
+    pcache.hand = (pcache.hand + 1) % NPCBUCKET;
+    for(pp = &pcache.bucket[b]; (cp = *pp) != 0; pp = &cp->next){
+      if(getref(cp->pa) == 1){
+        *pp = cp->next;
+        cp->ep->ncached--;
+        pcache.npages--;
+        kfree((void*)cp->pa);
+        return cp;
+      }
+    }
+  }
+  return 0;
+}
+
+// Return the page of ep holding len bytes from offset off, with a
+// reference for the caller. Unless shared is set the caller must map
+// it without PTE_W. Reads the file on a miss and may sleep; the caller
+// may already hold ep->lock. Returns 0 if out of memory or if the
+// file cannot be read.
+uint64
+pcache_get(struct dirent *ep, uint off, uint len, int shared)
+{
+  struct cpage *cp, *victim = 0, *node;
+  char *mem;
+  int locked;
+  uint want;
+
+  acquire(&pcache.lock);
+  if((cp = pclookup(ep, off, len)) != 0){
+    incref(cp->pa);
+    cp->shared |= shared;
+    pcache.hit++;
+    release(&pcache.lock);
+    return cp->pa;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+  node = kmem_cache_alloc(pcache.cache);
+
+  // read(fd, buf) may fault on a buf that is mapped from the file
+  // being read, with ep->lock already held by us.
+  locked = holdingsleep(&ep->lock);
+  if(!locked)
+    elock(ep);
+  // bytes past the end of the file stay zero; anything less than the
+  // rest is an I/O error, which must not be cached as the contents
+  want = off < ep->file_size ? ep->file_size - off : 0;
+  if(want > len)
+    want = len;
+  if(eread(ep, 0, (uint64)mem, off, len) != want){
+    if(!locked)
+      eunlock(ep);
+    kfree(mem);
+    if(node)
+      kmem_cache_free(pcache.cache, node);
+    return 0;
+  }
+
+  // Insert before unlocking ep: a writer either finished before
+  // our read or will drop this page after us.
+  acquire(&pcache.lock);
+  pcache.miss++;
+  if((cp = pclookup(ep, off, len)) != 0){
+    // someone else read it meanwhile
+    incref(cp->pa);
+    cp->shared |= shared;
+    release(&pcache.lock);
+    if(!locked)
+      eunlock(ep);
+    kfree(mem);
+    if(node)
+      kmem_cache_free(pcache.cache, node);
+    return cp->pa;
+  }
+  if(pcache.npages >= PCACHE_PAGES)
+    victim = pcevict();
+  if(node && pcache.npages < PCACHE_PAGES){
+    int b = pchash(ep, off);
+    node->ep = ep;
+    node->off = off;
+    node->len = len;
+    node->shared = shared;
+    node->pa = (uint64)mem;
+    node->next = pcache.bucket[b];
+    pcache.bucket[b] = node;
+    ep->ncached++;
+    pcache.npages++;
+    incref((uint64)mem);    // the cache's own reference
+    node = 0;
+  }
+  release(&pcache.lock);
+  if(!locked)
+    eunlock(ep);
+
+  // not cached (full or no node): the page is simply private
+  if(node)
+    kmem_cache_free(pcache.cache, node);
+  if(victim)
+    kmem_cache_free(pcache.cache, victim);
+  return (uint64)mem;
+}
+
+// Forget every cached page of ep. Pages still mapped stay with their
+// mappers. Caller holds ep->lock, or ep is unreferenced, so no new
+// page of ep can be inserted meanwhile.
+void
+pcache_drop(struct dirent *ep)
+{
+  struct cpage *cp, **pp, *dead = 0;
+
+  if(ep->ncached == 0)
+    return;
+
+  acquire(&pcache.lock);
+  for(int b = 0; b < NPCBUCKET && ep->ncached > 0; b++){
+    for(pp = &pcache.bucket[b]; (cp = *pp) != 0; ){
+      if(cp->ep == ep){
+        *pp = cp->next;
+        ep->ncached--;
+        pcache.npages--;
+        kfree((void*)cp->pa);
+        cp->next = dead;
+        dead = cp;
+      } else {
+        pp = &cp->next;
+      }
+    }
+  }
+  release(&pcache.lock);
+
+  while((cp = dead) != 0){
+    dead = cp->next;
+    kmem_cache_free(pcache.cache, cp);
+  }
+}
+
+// [off, off+n) of ep has just been written. Drop ep's private pages,
+// which would go stale; bring its shared pages up to date from the
+// file unless refresh is 0 (the data came from those pages). Caller
+// holds ep->lock. May sleep.
+void
+pcache_written(struct dirent *ep, uint off, uint n, int refresh)
+{
+  struct cpage *cp, **pp, *dead = 0;
+  struct { uint64 pa; uint off, len; } upd[8];
+  int nupd;
+
+  if(ep->ncached == 0)
+    return;
+
+  acquire(&pcache.lock);
+  for(int b = 0; b < NPCBUCKET; b++){
+    for(pp = &pcache.bucket[b]; (cp = *pp) != 0; ){
+      if(cp->ep == ep && !cp->shared){
+        *pp = cp->next;
+        ep->ncached--;
+        pcache.npages--;
+        kfree((void*)cp->pa);
+        cp->next = dead;
+        dead = cp;
+      } else {
+        pp = &cp->next;
+      }
+    }
+  }
+  release(&pcache.lock);
+  while((cp = dead) != 0){
+    dead = cp->next;
+    kmem_cache_free(pcache.cache, cp);
+  }
+
+  // a few pages at a time: eread() sleeps, so pin them first
+  for(uint o = PGROUNDDOWN(off); refresh && o < off + n; o += PGSIZE){
+    nupd = 0;
+    acquire(&pcache.lock);
+    for(cp = pcache.bucket[pchash(ep, o)]; cp && nupd < 8; cp = cp->next){
+      if(cp->ep == ep && cp->off == o){
+        incref(cp->pa);
+        upd[nupd].pa = cp->pa;
+        upd[nupd].off = cp->off;
+        upd[nupd].len = cp->len;
+        nupd++;
+      }
+    }
+    release(&pcache.lock);
+    for(int i = 0; i < nupd; i++){
+      uint lo = off > upd[i].off ? off : upd[i].off;
+      uint hi = off + n < upd[i].off + upd[i].len ? off + n : upd[i].off + upd[i].len;
+      if(lo < hi)
+        eread(ep, 0, upd[i].pa + (lo - upd[i].off), lo, hi - lo);
+      kfree((void*)upd[i].pa);
+    }
+  }
+}
+
+// 读取页缓存统计信息，不加锁读取，仅供参考
+void
+pcache_stat(uint64 *npages, uint64 *hit, uint64 *miss)
+{
+  *npages = pcache.npages;
+  *hit = pcache.hit;
+  *miss = pcache.miss;
+}
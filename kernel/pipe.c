@@ -9,6 +9,22 @@
 #include "include/pipe.h"
 #include "include/kalloc.h"
 #include "include/vm.h"
+#include "include/slab.h"
+
+static struct kmem_cache *pipe_cache;
+
+static void
+pipe_ctor(void *obj)
+{
+  struct pipe *pi = obj;
+  initlock(&pi->lock, "pipe");
+}
+
+void
+pipeinit(void)
+{
+  pipe_cache = kmem_cache_create("pipe", sizeof(struct pipe), pipe_ctor);
+}
 
 int
 pipealloc(struct file **f0, struct file **f1)
@@ -19,13 +35,13 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == NULL || (*f1 = filealloc()) == NULL)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == NULL)
+  if((pi = (struct pipe*)kmem_cache_alloc(pipe_cache)) == NULL)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  pi->reading = 0;
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -38,7 +54,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipe_cache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -59,62 +75,89 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    kmem_cache_free(pipe_cache, pi);
   } else
     release(&pi->lock);
 }
 
+// User memory is copied through a small buffer on the kernel stack,
+// outside pi->lock: faulting a user page in may sleep.
+#define PIPECHUNK 128
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
-  char ch;
+  int i, j, m;
+  char buf[PIPECHUNK];
   struct proc *pr = myproc();
 
-  acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
-        release(&pi->lock);
-        return -1;
+  for(i = 0; i < n; i += m){
+    m = n - i < PIPECHUNK ? n - i : PIPECHUNK;
+    if(copyin2(buf, addr + i, m) == -1)
+      break;
+    acquire(&pi->lock);
+    for(j = 0; j < m; j++){
+      while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(pi->readopen == 0 || pr->killed){
+          release(&pi->lock);
+          return -1;
+        }
+        wakeup(&pi->nread);
+        sleep(&pi->nwrite, &pi->lock);
       }
-      wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
+      pi->data[pi->nwrite++ % PIPESIZE] = buf[j];
     }
-    // if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-    if(copyin2(&ch, addr + i, 1) == -1)
-      break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    wakeup(&pi->nread);
+    release(&pi->lock);
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
   return i;
 }
 
+// Data is consumed only after it has been copied out, so a failed
+// copy leaves it in the pipe. Readers take turns (pi->reading) so
+// that two of them never copy out the same bytes.
 int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
+  int i = 0, j, m;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPECHUNK];
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->reading){
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
+    sleep(&pi->reading, &pi->lock);
+  }
+  pi->reading = 1;
+  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+    if(pr->killed){
+      i = -1;
+      goto out;
+    }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    // if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-    if(copyout2(addr + i, &ch, 1) == -1)
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    m = n - i < PIPECHUNK ? n - i : PIPECHUNK;
+    if(m > pi->nwrite - pi->nread)
+      m = pi->nwrite - pi->nread;
+    for(j = 0; j < m; j++)
+      buf[j] = pi->data[(pi->nread + j) % PIPESIZE];
+    release(&pi->lock);
+    if(copyout2(addr + i, buf, m) == -1){
+      acquire(&pi->lock);
       break;
+    }
+    acquire(&pi->lock);
+    pi->nread += m;
+    i += m;
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+out:
+  pi->reading = 0;
+  wakeup(&pi->reading);
   release(&pi->lock);
   return i;
 }
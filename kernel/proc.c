@@ -5,6 +5,7 @@
 #include "include/riscv.h"
 #include "include/spinlock.h"
 #include "include/proc.h"
+#include "include/asid.h"
 #include "include/intr.h"
 #include "include/kalloc.h"
 #include "include/printf.h"
@@ -14,6 +15,10 @@
 #include "include/trap.h"
 #include "include/vm.h"
 #include "include/timer.h"
+#include "include/exec.h"
+#include "include/spawn.h"
+#include "include/swap.h"
+#include "include/ksm.h"
 
 
 struct cpu cpus[NCPU];
@@ -60,18 +65,18 @@ procinit(void)
       initlock(&p->lock, "proc");
 
       // Allocate a page for the process's kernel stack.
-      // Map it high in memory, followed by an invalid
-      // guard page.
-      // char *pa = kalloc();
-      // // printf("[procinit]kernel stack: %p\n", (uint64)pa);
-      // if(pa == 0)
-      //   panic("kalloc");
-      // uint64 va = KSTACK((int) (p - proc));
-      // // printf("[procinit]kvmmap va %p to pa %p\n", va, (uint64)pa);
-      // kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-      // p->kstack = va;
+      // Map it high in memory, above an invalid
+      // guard page. All kernel stacks live in the
+      // shared kernel page table, so user page tables
+      // created later see them too.
+      char *pa = kalloc();
+      if(pa == 0)
+        panic("kalloc");
+      uint64 va = KSTACK((int) (p - proc));
+      kvmmap(va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+      p->kstack = va;
   }
-  //kvminithart();
+  sfence_vma();
 
   memset(cpus, 0, sizeof(cpus));
   #ifdef DEBUG
@@ -151,17 +156,16 @@ found:
   // Initialize trapframe to zero
   memset(p->trapframe, 0, sizeof(struct trapframe));
 
-  // An empty user page table.
-  // And an identical kernel page table for this proc.
-  if ((p->pagetable = proc_pagetable(p)) == NULL ||
-      (p->kpagetable = proc_kpagetable()) == NULL) {
+  // An empty user page table, sharing the kernel half
+  // with kernel_pagetable.
+  p->asid = 0;
+  p->asid_cpu = -1;
+  if((p->pagetable = proc_pagetable(p)) == NULL){
     freeproc(p);
     release(&p->lock);
     return NULL;
   }
 
-  p->kstack = VKSTACK;
-
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -171,6 +175,13 @@ found:
   // Set default priority
   p->priority = 50;  // Default priority (medium)
 
+  p->fault_around = FAULT_AROUND;
+  p->heap_advice = MADV_NORMAL;
+  p->uaccess = 0;
+  p->vmbusy = 0;
+  p->nfault = 0;
+  p->nfault_saved = 0;
+
   // Initialize MLFQ fields
   p->queue_level = 0;        // New processes start at highest priority queue
   p->time_slice = 0;         // Will be set by scheduler when first run
@@ -209,10 +220,6 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if (p->kpagetable) {
-    kvmfree(p->kpagetable, 1);
-  }
-  p->kpagetable = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
@@ -346,7 +353,7 @@ userinit(void)
   
   // allocate one user page and copy init's instructions
   // and data into it.
-  uvminit(p->pagetable , p->kpagetable, initcode, sizeof(initcode));
+  uvminit(p->pagetable, initcode, sizeof(initcode));
   p->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
@@ -374,13 +381,17 @@ growproc(int n)
   struct proc *p = myproc();
 
   sz = p->sz;
+  p->vmbusy++;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, p->kpagetable, sz, sz + n)) == 0) {
+    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+      p->vmbusy--;
       return -1;
     }
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, p->kpagetable, sz, sz + n);
+    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    vma_trimheap(&p->vma_manager, sz);
   }
+  p->vmbusy--;
   p->sz = sz;
   return 0;
 }
@@ -400,13 +411,27 @@ fork(void)
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, np->kpagetable, p->sz) < 0){
+  p->vmbusy++;
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+    p->vmbusy--;
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
 
+  // Copy VMA list from parent to child, and share the pages already
+  // mapped in mmap areas: COW for private ones, as for [0, sz)
+  if(vma_copy(&np->vma_manager, &p->vma_manager) < 0 ||
+     vma_fork(&p->vma_manager, p->pagetable, np->pagetable, p->sz) < 0){
+    p->vmbusy--;
+    vma_cleanup(&np->vma_manager);   // 父进程仍持有文件引用，不会睡眠
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  p->vmbusy--;
+
   np->parent = p;
 
   // copy tracing mask from parent.
@@ -419,6 +444,8 @@ fork(void)
 
   // copy priority from parent
   np->priority = p->priority;
+  np->fault_around = p->fault_around;
+  np->heap_advice = p->heap_advice;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -432,9 +459,6 @@ fork(void)
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = edup(p->cwd);
 
-  // Copy VMA list from parent to child
-  vma_copy(&np->vma_manager, &p->vma_manager);
-
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
@@ -446,6 +470,73 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program at path, without copying
+// the caller's address space first. The child gets the caller's open
+// files after the actions in act[0..nact) are applied to them, its
+// cwd, priority, trace mask and sandbox policy, like fork()+exec().
+// Unlike fork()+exec(), a missing or bad program is reported to the
+// caller. Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawn_action *act, int nact)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct execimage img;
+  struct file *ofile[NOFILE];
+
+  // Work the file actions out on a copy of our table first, so
+  // nothing has to be undone once the child exists.
+  memmove(ofile, p->ofile, sizeof(ofile));
+  for(i = 0; i < nact; i++){
+    int fd = act[i].fd;
+    if(fd < 0 || fd >= NOFILE)
+      return -1;
+    if(act[i].op == SPAWN_DUP2){
+      if(act[i].newfd < 0 || act[i].newfd >= NOFILE || ofile[fd] == NULL)
+        return -1;
+      ofile[act[i].newfd] = ofile[fd];
+    } else if(act[i].op == SPAWN_CLOSE){
+      ofile[fd] = NULL;
+    } else {
+      return -1;
+    }
+  }
+
+  // Loading may sleep, so do it before taking a proc slot.
+  if(exec_prepare(path, argv, &img) < 0)
+    return -1;
+
+  if((np = allocproc()) == NULL){
+    exec_discard(&img);
+    return -1;
+  }
+  if(exec_install(np, &img) < 0){
+    exec_discard(&img);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+
+  np->parent = p;
+  np->tmask = p->tmask;
+  np->sandbox_on = p->sandbox_on;
+  np->sandbox_action = p->sandbox_action;
+  memmove(np->allow_mask, p->allow_mask, sizeof(np->allow_mask));
+  np->priority = p->priority;
+
+  for(i = 0; i < NOFILE; i++)
+    if(ofile[i])
+      np->ofile[i] = filedup(ofile[i]);
+  np->cwd = edup(p->cwd);
+
+  pid = np->pid;
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -495,7 +586,10 @@ exit(int status)
   eput(p->cwd);
   p->cwd = 0;
 
-  // Cleanup VMA (close files and free mappings)
+  // Cleanup VMA (close files and free mappings). The page table is
+  // being torn down from here on, so swap and KSM leave it alone.
+  p->vmbusy++;
+  vma_unmapall(&p->vma_manager, p->pagetable);
   vma_cleanup(&p->vma_manager);
 
   // we might re-parent a child to init. we can't be precise about
@@ -567,14 +661,13 @@ wait(uint64 addr)
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout2(addr, (char *)&np->xstate, sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&p->lock);
-            return -1;
-          }
+          int xstate = np->xstate;
           freeproc(np);
           release(&np->lock);
           release(&p->lock);
+          // the copy may fault in a page and sleep, so not under the locks
+          if(addr != 0 && copyout2(addr, (char *)&xstate, sizeof(xstate)) < 0)
+            return -1;
           return pid;
         }
         release(&np->lock);
@@ -635,11 +728,13 @@ scheduler(void)
             }
           }
 
-          w_satp(MAKE_SATP(p->kpagetable));
-          sfence_vma();
+          // switch to p's address space; thanks to ASIDs this
+          // usually keeps the TLB, see asid.c.
+          asid_activate(p);
           swtch(&c->context, &p->context);
+          // back on kernel_pagetable (ASID 0). p's entries stay
+          // cached under its own ASID, no flush needed.
           w_satp(MAKE_SATP(kernel_pagetable));
-          sfence_vma();
           // Process is done running for now.
           // It should have changed its p->state before coming back.
           c->proc = 0;
@@ -657,7 +752,10 @@ scheduler(void)
 
     if(found == 0) {
       intr_on();
-      asm volatile("wfi");
+      // 空闲时先预清零一批页面，再让同页合并扫描一批，
+      // 两者都没事可做才真正休眠
+      if(kmem_prezero(KMEM_PREZERO_BATCH) == 0 && ksm_scan() == 0)
+        asm volatile("wfi");
     }
   }
 }
@@ -782,6 +880,7 @@ forkret(void)
     first = 0;
     fat32_init();
     myproc()->cwd = ename("/");
+    swapinit();
   }
 
   usertrapret();
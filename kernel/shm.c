@@ -4,6 +4,7 @@
 #include "include/riscv.h"
 #include "include/spinlock.h"
 #include "include/proc.h"
+#include "include/asid.h"
 #include "include/syscall.h"
 #include "include/kalloc.h"
 #include "include/vm.h"
@@ -22,6 +23,7 @@ struct shm_segment {
   int key;             // 用户提供的键值
   uint64 pa;           // 物理地址
   uint64 size;         // 大小（字节）
+  int order;           // 物理块的阶（2^order 页）
   int ref_count;       // 附加进程计数
   int perm;            // 权限标志
   int used;            // 是否使用
@@ -114,19 +116,27 @@ do_shmget(int key, uint64 size, int flag)
   int npages = (size + PGSIZE - 1) / PGSIZE;
   if (npages == 0) npages = 1;
 
-  // 分配物理内存
-  char *mem = kalloc();
+  // 计算能容纳 npages 页的最小阶
+  int order = 0;
+  while ((1 << order) < npages)
+    order++;
+
+  // 从伙伴系统分配物理连续的内存
+  // 单页段直接从预清零池分配
+  char *mem = order == 0 ? kalloc_zeroed() : kalloc_pages(order);
   if (!mem) {
     release(&shm_table.lock);
     return -1;  // 内存不足
   }
-  memset(mem, 0, PGSIZE);
+  if (order > 0)
+    memset(mem, 0, (uint64)PGSIZE << order);
 
   // 初始化共享内存段
   seg->id = shm_table.next_id++;
   seg->key = key;
   seg->pa = (uint64)mem;
   seg->size = npages * PGSIZE;
+  seg->order = order;
   seg->ref_count = 0;
   seg->perm = flag;
   seg->used = 1;
@@ -167,6 +177,11 @@ do_shmat(int shmid, uint64 addr, int flag)
     release(&shm_table.lock);
     return (void*)-1;
   }
+  sfence_vma_range(p, va, seg->size / PGSIZE);
+  // 每个映射都持有页的引用：回收不会把仍有人共享的页换出，
+  // 进程退出释放映射时也不会真正释放段的物理内存
+  for (uint64 off = 0; off < seg->size; off += PGSIZE)
+    incref(seg->pa + off);
 
   // 更新进程内存大小
   p->sz += seg->size;
@@ -215,7 +230,8 @@ do_shmdt(uint64 addr)
   }
 
   // 解除映射
-  vmunmap(p->pagetable, va, seg->size / PGSIZE, 0);
+  vmunmap(p->pagetable, va, seg->size / PGSIZE, 1);  // 放掉映射的引用
+  sfence_vma_range(p, va, seg->size / PGSIZE);
 
   // 更新进程内存大小
   if (p->sz > seg->size) {
@@ -259,7 +275,7 @@ do_shmctl(int shmid, int cmd, void *buf)
     }
 
     // 释放物理内存
-    kfree((void*)seg->pa);
+    kfree_pages((void*)seg->pa, seg->order);
 
     // 标记为未使用
     seg->used = 0;
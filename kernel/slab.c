@@ -0,0 +1,257 @@
+// Slab object caches for small, fixed-size kernel objects.
+// Each slab is a single page obtained from kalloc(), cut into
+// equal-sized objects. A per-hart magazine in front of every
+// cache lets the common alloc/free path run without taking
+// the cache lock.
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/intr.h"
+#include "include/proc.h"
+#include "include/kalloc.h"
+#include "include/slab.h"
+#include "include/string.h"
+#include "include/printf.h"
+
+#define SLAB_NCACHE  16   // 系统中最多的 cache 数量
+
+// slab 页头，位于每个 slab 页的开头
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;
+  struct slab *prev;
+  void *freelist;         // 空闲对象链表
+  uint inuse;             // 本 slab 中已分配出去的对象数
+};
+
+#define SLAB_HDRSIZE  ((sizeof(struct slab) + 7) & ~7UL)
+
+// 空闲链指针放在对象之后，不覆盖已构造对象的内容
+#define OBJ_LINK(c, obj)  (*(void **)((char *)(obj) + (c)->stride - sizeof(void *)))
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache caches[SLAB_NCACHE];
+  int ncache;
+  struct kmem_cache *head;
+} slab_table;
+
+void
+kmem_cache_init(void)
+{
+  initlock(&slab_table.lock, "slab_table");
+  slab_table.ncache = 0;
+  slab_table.head = NULL;
+  #ifdef DEBUG
+  printf("kmem_cache_init\n");
+  #endif
+}
+
+// 创建一个对象大小为 size 的 cache。
+// ctor 在对象第一次被切分出来时调用，释放回 cache 的对象
+// 应当保持构造后的状态。失败时 panic，只应在初始化阶段调用。
+struct kmem_cache *
+kmem_cache_create(char *name, uint size, void (*ctor)(void *))
+{
+  struct kmem_cache *c;
+
+  acquire(&slab_table.lock);
+  if (slab_table.ncache >= SLAB_NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slab_table.caches[slab_table.ncache++];
+  c->next = slab_table.head;
+  slab_table.head = c;
+  release(&slab_table.lock);
+
+  memset(c, 0, (uint)((char *)&c->next - (char *)c));
+  safestrcpy(c->name, name, SLAB_NAME_LEN);
+  c->objsize = size;
+  c->stride = ((size + 7) & ~7U) + sizeof(void *);
+  c->perslab = (PGSIZE - SLAB_HDRSIZE) / c->stride;
+  if (c->perslab == 0)
+    panic("kmem_cache_create: object too large");
+  c->ctor = ctor;
+  initlock(&c->lock, "slab");
+  return c;
+}
+
+static void
+slab_unlink(struct slab **list, struct slab *s)
+{
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if (s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = NULL;
+}
+
+static void
+slab_link(struct slab **list, struct slab *s)
+{
+  s->prev = NULL;
+  s->next = *list;
+  if (*list)
+    (*list)->prev = s;
+  *list = s;
+}
+
+// 分配一个新的 slab 页并构造其中所有对象。
+// 调用者持有 c->lock。
+static struct slab *
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s = (struct slab *)kalloc();
+  if (s == NULL)
+    return NULL;
+
+  s->cache = c;
+  s->freelist = NULL;
+  s->inuse = 0;
+  char *obj = (char *)s + SLAB_HDRSIZE;
+  for (uint i = 0; i < c->perslab; i++, obj += c->stride) {
+    if (c->ctor)
+      c->ctor(obj);
+    OBJ_LINK(c, obj) = s->freelist;
+    s->freelist = obj;
+  }
+  slab_link(&c->partial, s);
+  c->nslab++;
+  return s;
+}
+
+// 从 slab 层取出一个对象。调用者持有 c->lock。
+static void *
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s = c->partial;
+
+  if (s == NULL) {
+    if ((s = c->empty) != NULL) {
+      slab_unlink(&c->empty, s);
+      slab_link(&c->partial, s);
+    } else if ((s = slab_grow(c)) == NULL) {
+      return NULL;
+    }
+  }
+
+  void *obj = s->freelist;
+  s->freelist = OBJ_LINK(c, obj);
+  s->inuse++;
+  if (s->freelist == NULL) {
+    slab_unlink(&c->partial, s);
+    slab_link(&c->full, s);
+  }
+  return obj;
+}
+
+// 把对象放回所属的 slab。调用者持有 c->lock。
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab *)PGROUNDDOWN((uint64)obj);
+
+  if (s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+
+  int wasfull = (s->freelist == NULL);
+  OBJ_LINK(c, obj) = s->freelist;
+  s->freelist = obj;
+  s->inuse--;
+
+  if (wasfull) {
+    slab_unlink(&c->full, s);
+    slab_link(&c->partial, s);
+  }
+  if (s->inuse == 0) {
+    slab_unlink(&c->partial, s);
+    if (c->empty == NULL) {
+      slab_link(&c->empty, s);
+    } else {
+      // 已经保留了一个空 slab，多余的直接还给页分配器
+      c->nslab--;
+      kfree((void *)s);
+    }
+  }
+}
+
+// 从 cache 中分配一个对象，返回的对象处于构造后的状态。
+// Returns 0 if out of memory.
+void *
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj = NULL;
+
+  push_off();
+  struct kmem_magazine *mag = &c->mag[cpuid()];
+  if (mag->count > 0) {
+    obj = mag->objs[--mag->count];
+    __sync_fetch_and_add(&c->maghit, 1);
+  } else {
+    // magazine 空了，从 slab 层一次补充半个 magazine
+    acquire(&c->lock);
+    obj = slab_get(c);
+    while (obj && mag->count < SLAB_MAG_SIZE / 2) {
+      void *extra = slab_get(c);
+      if (extra == NULL)
+        break;
+      mag->objs[mag->count++] = extra;
+    }
+    release(&c->lock);
+  }
+  pop_off();
+
+  if (obj) {
+    __sync_fetch_and_add(&c->inuse, 1);
+    __sync_fetch_and_add(&c->nalloc, 1);
+  }
+  return obj;
+}
+
+// 释放一个由 kmem_cache_alloc() 分配的对象。
+// 调用者需要先把对象恢复到构造后的状态（例如释放持有的锁）。
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  if (obj == NULL)
+    return;
+  __sync_fetch_and_sub(&c->inuse, 1);
+
+  push_off();
+  struct kmem_magazine *mag = &c->mag[cpuid()];
+  if (mag->count < SLAB_MAG_SIZE) {
+    mag->objs[mag->count++] = obj;
+  } else {
+    // magazine 满了，归还一半到 slab 层
+    acquire(&c->lock);
+    slab_put(c, obj);
+    while (mag->count > SLAB_MAG_SIZE / 2)
+      slab_put(c, mag->objs[--mag->count]);
+    release(&c->lock);
+  }
+  pop_off();
+}
+
+// 填充至多 max 个 cache 的统计信息，返回填充的数量
+int
+kmem_cache_stats(struct slabinfo *info, int max)
+{
+  int n = 0;
+  struct kmem_cache *c;
+
+  acquire(&slab_table.lock);
+  for (c = slab_table.head; c != NULL && n < max; c = c->next, n++) {
+    safestrcpy(info[n].name, c->name, SLAB_NAME_LEN);
+    info[n].objsize = c->objsize;
+    info[n].inuse = c->inuse;
+    info[n].total = c->nslab * c->perslab;
+    info[n].nslab = c->nslab;
+    info[n].nalloc = c->nalloc;
+    info[n].maghit = c->maghit;
+  }
+  release(&slab_table.lock);
+  return n;
+}
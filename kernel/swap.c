@@ -0,0 +1,372 @@
+// Anonymous page reclaim to a swap file.
+//
+// When free memory runs low, user pages that exactly one PTE maps
+// are written to the preallocated SWAPFILE on the FAT32 volume.
+// A second-chance clock sweeps the page tables of every process that
+// is not running on another hart and is not stopped in the middle of
+// editing its page table (p->vmbusy): a fault, fork() or munmap()
+// that slept or was preempted may still hold a PTE or a physical
+// address it read before. A page found with PTE_A set loses
+// the bit and survives this round, one found with PTE_A clear is
+// evicted. Its PTE keeps the permission bits but loses PTE_V, gains
+// PTE_SWAP and holds the slot number instead of the PPN, so fork()
+// can share the slot and a fault knows where to read the page from.
+//
+// The PTE is switched to the slot while the owner cannot run, before
+// the page is written out. Until the write completes the page stays
+// in swap.cache[] and a fault in the meantime takes it from there;
+// a slot is not reused while its write is in flight.
+//
+// Every victim is first offered to the compressed store in zram.c.
+// If it takes the page, the slot is marked swap.zram[] and no I/O is
+// done at all; only pages that do not compress go to the swap file.
+// Slots [0, ndisk) have room in the file, the rest of the SWAP_PAGES
+// slots can only hold compressed pages and are used for them first,
+// so swapping works without a swap file too.
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/memlayout.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/sleeplock.h"
+#include "include/proc.h"
+#include "include/fat32.h"
+#include "include/kalloc.h"
+#include "include/vm.h"
+#include "include/vma.h"
+#include "include/asid.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/swap.h"
+#include "include/zram.h"
+
+extern struct proc proc[NPROC];
+
+static struct {
+  struct spinlock lock;
+  struct sleeplock reclaim;     // one reclaimer at a time
+  int on;                       // swapinit() has run
+  struct dirent *ep;            // the swap file, 0 if there is none
+  int ndisk;                    // slots backed by the swap file
+  ushort ref[SWAP_PAGES];       // swap PTEs naming each slot
+  uchar busy[SWAP_PAGES];       // write-out in progress
+  uchar zram[SWAP_PAGES];       // page is in zpage[], not in the file
+  uint64 cache[SWAP_PAGES];     // page still in memory, holds a ref
+  struct zpage zpage[SWAP_PAGES];
+  int next;                     // where to look for a free file slot
+  int nused;                    // file slots in use
+  int hand;                     // clock hand: index into proc[]
+  uint64 handva;                // and the next address to look at
+  uint64 nout;
+  uint64 nin;
+  uint64 zout;
+  uint64 zin;
+} swap;
+
+// Open the swap file. Called once from the first process, after the
+// file system is up.
+void
+swapinit(void)
+{
+  struct dirent *ep;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.reclaim, "swapreclaim");
+  swap.on = 1;
+  if((ep = ename(SWAPFILE)) == 0){
+    printf("swap: no %s, compressed swap only\n", SWAPFILE);
+    return;
+  }
+  swap.ndisk = ep->file_size / PGSIZE;
+  if(swap.ndisk > SWAP_PAGES)
+    swap.ndisk = SWAP_PAGES;
+  if(swap.ndisk == 0){
+    eput(ep);
+    return;
+  }
+  swap.ep = ep;
+}
+
+static inline int
+slot_isfree(int s)
+{
+  return swap.ref[s] == 0 && swap.cache[s] == 0;
+}
+
+// Find a free slot, one backed by the swap file if disk is set.
+// Caller holds swap.lock.
+static int
+slot_alloc(int disk)
+{
+  int s;
+
+  if(!disk){
+    for(s = swap.ndisk; s < SWAP_PAGES; s++)
+      if(slot_isfree(s))
+        goto found;
+  }
+  for(int i = 0; i < swap.ndisk; i++){
+    s = (swap.next + i) % swap.ndisk;
+    if(slot_isfree(s)){
+      swap.next = (s + 1) % swap.ndisk;
+      swap.nused++;
+      goto found;
+    }
+  }
+  return -1;
+
+found:
+  swap.ref[s] = 1;
+  swap.zram[s] = !disk;
+  return s;
+}
+
+// fork() copied the swap PTE pte.
+void
+swap_dup(pte_t pte)
+{
+  acquire(&swap.lock);
+  swap.ref[PTE2SLOT(pte)]++;
+  release(&swap.lock);
+}
+
+// The swap PTE pte is gone.
+void
+swap_free(pte_t pte)
+{
+  int s = PTE2SLOT(pte);
+
+  acquire(&swap.lock);
+  if(swap.ref[s] == 0)
+    panic("swap_free");
+  if(--swap.ref[s] == 0){
+    if(s < swap.ndisk)
+      swap.nused--;
+    if(swap.zram[s]){
+      zram_free(&swap.zpage[s]);
+      swap.zram[s] = 0;
+    }
+    if(swap.cache[s] && !swap.busy[s]){
+      kfree((void*)swap.cache[s]);
+      swap.cache[s] = 0;
+    }
+  }
+  release(&swap.lock);
+}
+
+// Bring back the page behind the swap PTE *pte of p at va.
+// May sleep. Returns 0 on success, -1 if out of memory.
+int
+swap_in(struct proc *p, uint64 va, pte_t *pte)
+{
+  pte_t e = *pte;
+  int s = PTE2SLOT(e);
+  char *mem = 0;
+  int z;
+
+  acquire(&swap.lock);
+  z = swap.zram[s];
+  if(swap.cache[s]){
+    if(swap.ref[s] == 1){
+      // still in memory and ours alone: take it back
+      mem = (char*)swap.cache[s];
+      incref((uint64)mem);
+    } else if((mem = kalloc()) != 0){
+      memmove(mem, (void*)swap.cache[s], PGSIZE);
+    } else {
+      release(&swap.lock);
+      return -1;
+    }
+  }
+  release(&swap.lock);
+
+  if(mem == 0){
+    if((mem = kalloc()) == 0)
+      return -1;
+    if(z){
+      // our PTE holds a ref on the slot, so zpage[s] stays put
+      zram_load(&swap.zpage[s], mem);
+      goto done;
+    }
+    elock(swap.ep);
+    int n = eread(swap.ep, 0, (uint64)mem, s * PGSIZE, PGSIZE);
+    eunlock(swap.ep);
+    if(n != PGSIZE){
+      kfree(mem);
+      return -1;
+    }
+  }
+
+done:
+  *pte = PA2PTE(mem) | (PTE_FLAGS(e) & ~PTE_SWAP) | PTE_V;
+  swap_free(e);
+  sfence_vma_range(p, va, 1);
+  __sync_fetch_and_add(z ? &swap.zin : &swap.nin, 1);
+  p->nfault++;
+  return 0;
+}
+
+struct victim {
+  int slot;
+  int zram;                     // compressed, no write-out needed
+  uint64 pa;
+};
+
+// Run the clock over q's page table from swap.handva on, evicting at
+// most n pages into v[]. Returns the number evicted; swap.handva is
+// MAXUVA once q has been swept completely.
+// Caller holds q->lock, and q is not running on another hart and
+// not editing its page table, or is the caller itself.
+static int
+swap_scan(struct proc *q, struct victim *v, int n)
+{
+  int nv = 0, touched = 0;
+  uint64 va, size, pa;
+  pte_t *pte, e;
+  struct vma *vma;
+  struct zpage zp;
+
+  for(va = swap.handva; va < MAXUVA && nv < n; va += PGSIZE){
+    pte = walksize(q->pagetable, va, 0, &size);
+    if(pte == 0 || size == MEGAPGSIZE){
+      va = MEGAPGROUNDDOWN(va) + MEGAPGSIZE - PGSIZE;
+      continue;                 // no level-0 table here
+    }
+    e = *pte;
+    if((e & PTE_V) == 0 || (e & PTE_U) == 0)
+      continue;
+    pa = PTE2PA(e);
+    if(pa == zero_page || getref(pa) != 1)
+      continue;                 // shared: other PTEs would still map it
+    if(e & PTE_A){
+      *pte = e & ~PTE_A;        // second chance
+      touched = 1;
+      continue;
+    }
+    vma = vma_lookup(&q->vma_manager, va);
+    if(vma && (vma->flags & MAP_SHARED))
+      continue;
+
+    int z = zram_store((char*)pa, &zp) == 0;
+    if(!z && swap.ep == 0)
+      continue;                 // does not compress, nowhere else to go
+
+    acquire(&swap.lock);
+    int s = slot_alloc(!z);
+    if(s >= 0){
+      swap.busy[s] = 1;
+      swap.cache[s] = pa;       // the PTE's reference moves here
+      if(z)
+        swap.zpage[s] = zp;
+    }
+    release(&swap.lock);
+    if(s < 0){
+      if(z)
+        zram_free(&zp);
+      break;                    // swap is full
+    }
+    *pte = SLOT2PTE(s) | (PTE_FLAGS(e) & ~(PTE_V | PTE_A | PTE_D)) | PTE_SWAP;
+    v[nv].slot = s;
+    v[nv].zram = z;
+    v[nv].pa = pa;
+    nv++;
+  }
+  swap.handva = va;
+
+  if(nv > 0 || touched){
+    if(q == myproc())
+      sfence_vma_proc(q);
+    else
+      asid_invalidate(q);
+  }
+  return nv;
+}
+
+// Evict up to n pages. Returns the number of pages freed.
+int
+swap_reclaim(int n)
+{
+  struct victim v[SWAP_BATCH];
+  int nv = 0, freed = 0;
+
+  if(!swap.on)
+    return 0;
+  if(n > SWAP_BATCH)
+    n = SWAP_BATCH;
+
+  acquiresleep(&swap.reclaim);
+  // two sweeps at most: the first may only clear PTE_A bits
+  for(int i = 0; i <= 2 * NPROC && nv < n; i++){
+    struct proc *q = &proc[swap.hand];
+    acquire(&q->lock);
+    // we are ourselves at a point where we hold no PTE: swap_balance()
+    // is only called between faults
+    if(q->pagetable != 0 && (q == myproc() ||
+       ((q->state == RUNNABLE || q->state == SLEEPING) && q->vmbusy == 0)))
+      nv += swap_scan(q, v + nv, n - nv);
+    else
+      swap.handva = MAXUVA;
+    release(&q->lock);
+    if(swap.handva >= MAXUVA){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.handva = 0;
+    }
+  }
+
+  for(int i = 0; i < nv; i++){
+    int s = v[i].slot;
+    int z = v[i].zram;
+    int ok = 1;
+    if(!z){
+      elock(swap.ep);
+      ok = ewrite(swap.ep, 0, v[i].pa, s * PGSIZE, PGSIZE) == PGSIZE;
+      eunlock(swap.ep);
+    }
+
+    acquire(&swap.lock);
+    swap.busy[s] = 0;
+    // if the write failed, the page stays in the swap cache until
+    // the slot is freed: still resident, but nothing is lost
+    if(ok || swap.ref[s] == 0){
+      kfree((void*)v[i].pa);
+      swap.cache[s] = 0;
+      freed++;
+    }
+    if(z)
+      swap.zout++;
+    else if(ok)
+      swap.nout++;
+    release(&swap.lock);
+  }
+  releasesleep(&swap.reclaim);
+  return freed;
+}
+
+// Reclaim a batch if free memory is below SWAP_LOWMEM pages.
+// Returns the number of pages freed.
+int
+swap_balance(void)
+{
+  if(!swap.on || freemem_amount() >= SWAP_LOWMEM * PGSIZE)
+    return 0;
+  return swap_reclaim(SWAP_BATCH);
+}
+
+// 读取交换统计信息，不加锁读取，仅供参考
+void
+swap_stat(uint64 *total, uint64 *used, uint64 *out, uint64 *in)
+{
+  *total = swap.ndisk;
+  *used = swap.nused;
+  *out = swap.nout;
+  *in = swap.nin;
+}
+
+// 压缩交换区的换出 / 换入次数
+void
+swap_zstat(uint64 *out, uint64 *in)
+{
+  *out = swap.zout;
+  *in = swap.zin;
+}
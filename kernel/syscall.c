@@ -8,7 +8,12 @@
 #include "include/syscall.h"
 #include "include/sysinfo.h"
 #include "include/kalloc.h"
+#include "include/slab.h"
 #include "include/vm.h"
+#include "include/pagecache.h"
+#include "include/swap.h"
+#include "include/zram.h"
+#include "include/ksm.h"
 #include "include/string.h"
 #include "include/printf.h"
 
@@ -132,6 +137,12 @@ extern uint64 sys_settime(void);
 extern uint64 sys_mmap(void);
 extern uint64 sys_munmap(void);
 extern uint64 sys_sandbox(void);
+extern uint64 sys_faultaround(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_ksm(void);
+extern uint64 sys_madvise(void);
+extern uint64 sys_mprotect(void);
+extern uint64 sys_msync(void);
 
 static uint64 (*syscalls[])(void) = {
   [SYS_fork]        sys_fork,
@@ -176,6 +187,12 @@ static uint64 (*syscalls[])(void) = {
   [SYS_mmap]         sys_mmap,
   [SYS_munmap]       sys_munmap,
   [SYS_sandbox]      sys_sandbox,
+  [SYS_faultaround]  sys_faultaround,
+  [SYS_spawn]        sys_spawn,
+  [SYS_ksm]          sys_ksm,
+  [SYS_madvise]      sys_madvise,
+  [SYS_mprotect]     sys_mprotect,
+  [SYS_msync]        sys_msync,
 };
 
 static char *sysnames[] = {
@@ -221,6 +238,12 @@ static char *sysnames[] = {
   [SYS_mmap]         "mmap",
   [SYS_munmap]       "munmap",
   [SYS_sandbox]      "sandbox",
+  [SYS_faultaround]  "faultaround",
+  [SYS_spawn]        "spawn",
+  [SYS_ksm]          "ksm",
+  [SYS_madvise]      "madvise",
+  [SYS_mprotect]     "mprotect",
+  [SYS_msync]        "msync",
 };
 
 void
@@ -286,6 +309,21 @@ sys_sysinfo(void)
   struct sysinfo info;
   info.freemem = freemem_amount();
   info.nproc = procnum();
+  for (int i = 0; i < NCPU; i++) {
+    kmem_pcpstat(i, &info.pcp[i].hit, &info.pcp[i].refill,
+                 &info.pcp[i].drain, &info.pcp[i].cached);
+  }
+  kmem_buddystat(info.nr_free);
+  kmem_zerostat(&info.zcached, &info.zhit, &info.zmiss);
+  info.zpmapped = getref(zero_page) - 1;
+  cow_stat(&info.cowcopy, &info.cowreuse, &info.cowzero);
+  pcache_stat(&info.pcpages, &info.pchit, &info.pcmiss);
+  swap_stat(&info.swaptotal, &info.swapused, &info.swapout, &info.swapin);
+  swap_zstat(&info.zramout, &info.zramin);
+  zram_stat(&info.zrampages, &info.zrambytes, &info.zramsame);
+  ksm_stat(&info.ksmshared, &info.ksmsaved, &info.ksmscanned,
+           &info.ksmmerged, &info.ksmpasses);
+  info.nslab = kmem_cache_stats(info.slab, SYSINFO_NSLAB);
 
   // if (copyout(p->pagetable, addr, (char *)&info, sizeof(info)) < 0) {
   if (copyout2(addr, (char *)&info, sizeof(info)) < 0) {
@@ -5,6 +5,7 @@
 #include "include/memlayout.h"
 #include "include/spinlock.h"
 #include "include/proc.h"
+#include "include/asid.h"
 #include "include/syscall.h"
 #include "include/timer.h"
 #include "include/kalloc.h"
@@ -16,26 +17,27 @@
 #include "include/vma.h"
 #include "include/file.h"
 
-extern int exec(char *path, char **argv);
+#include "include/exec.h"
+#include "include/spawn.h"
+#include "include/ksm.h"
+#include "include/swap.h"
 extern struct proc proc[NPROC];
 
-uint64
-sys_exec(void)
+// Copy the user argv array at uargv into argv[MAXARG], one page per
+// string. The caller frees them with freeargv() on success and failure.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[FAT32_MAX_PATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, FAT32_MAX_PATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG * sizeof(char *));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -43,22 +45,59 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
-
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void
+freeargv(char **argv)
+{
+  for(int i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
 
+uint64
+sys_exec(void)
+{
+  char path[FAT32_MAX_PATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret = -1;
+
+  if(argstr(0, path, FAT32_MAX_PATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// int spawn(char *path, char **argv, struct spawn_action *act, int nact)
+// Start path in a new child process without copying our memory.
+uint64
+sys_spawn(void)
+{
+  char path[FAT32_MAX_PATH], *argv[MAXARG];
+  struct spawn_action act[SPAWN_MAXACT];
+  uint64 uargv, uact;
+  int nact;
+  int ret = -1;
+
+  if(argstr(0, path, FAT32_MAX_PATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &uact) < 0 || argint(3, &nact) < 0)
+    return -1;
+  if(nact < 0 || nact > SPAWN_MAXACT)
+    return -1;
+  if(nact > 0 && copyin2((char*)act, uact, nact * sizeof(act[0])) < 0)
+    return -1;
+
+  if(fetchargv(uargv, argv) == 0)
+    ret = spawn(path, argv, act, nact);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -116,7 +155,11 @@ sys_sbrk(void)
     if(dec > oldsz)              // underflow
       return (uint64)-1;
     newsz = oldsz - dec;
-    p->sz = uvmdealloc(p->pagetable, p->kpagetable, oldsz, newsz);
+    p->vmbusy++;
+    p->sz = uvmdealloc(p->pagetable, oldsz, newsz);
+    p->vmbusy--;
+    // mprotect 为释放部分登记的 VMA 一并删除
+    vma_trimheap(&p->vma_manager, p->sz);
   }
   return oldsz;
 }
@@ -251,6 +294,8 @@ sys_getprocs(void)
       info.stime = p->stime;
       info.start_time = p->start_time;
       info.sz = p->sz;
+      info.nfault = p->nfault;
+      info.nfault_saved = p->nfault_saved;
       safestrcpy(info.name, p->name, sizeof(info.name));
 
       release(&p->lock);
@@ -281,21 +326,20 @@ sys_getrusage(void)
   if(argaddr(1, &stime_addr) < 0)
     return -1;
 
+  // copyout2() may sleep: take a snapshot under the lock first
   acquire(&p->lock);
+  uint64 utime = p->utime;
+  uint64 stime = p->stime;
+  release(&p->lock);
 
   // Copy utime to user space
-  if(utime_addr != 0 && copyout2(utime_addr, (char*)&p->utime, sizeof(p->utime)) < 0) {
-    release(&p->lock);
+  if(utime_addr != 0 && copyout2(utime_addr, (char*)&utime, sizeof(utime)) < 0)
     return -1;
-  }
 
   // Copy stime to user space
-  if(stime_addr != 0 && copyout2(stime_addr, (char*)&p->stime, sizeof(p->stime)) < 0) {
-    release(&p->lock);
+  if(stime_addr != 0 && copyout2(stime_addr, (char*)&stime, sizeof(stime)) < 0)
     return -1;
-  }
 
-  release(&p->lock);
   return 0;
 }
 
@@ -399,6 +443,8 @@ sys_mmap(void)
   // Check for invalid flag combinations
   if((flags & MAP_SHARED) && (flags & MAP_PRIVATE))
     return -1;  // Cannot specify both
+  if(flags & MAP_HEAP)
+    return -1;  // kernel-internal
 
   // Handle file mapping
   if(!(flags & MAP_ANONYMOUS)) {
@@ -406,6 +452,11 @@ sys_mmap(void)
       return -1;
 
     f = p->ofile[fd];
+    // 文件页按页缓存的页对齐共享；共享可写映射会写回文件
+    if(offset % PGSIZE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
     filedup(f);  // Increase file reference count
   }
 
@@ -418,15 +469,24 @@ sys_mmap(void)
     map_addr = PGROUNDDOWN(addr);
   } else {
     // Find free address range
-    if(vma_find_free_range(&p->vma_manager, addr, length, &map_addr) < 0)
+    if((flags & MAP_HUGETLB) && addr == 0 && length >= MEGAPGSIZE) {
+      // leave room to align the start so faults can use megapages
+      if(vma_find_free_range(&p->vma_manager, 0, length + MEGAPGSIZE - PGSIZE, &map_addr) < 0)
+        goto err;
+      map_addr = MEGAPGROUNDUP(map_addr);
+    } else if(vma_find_free_range(&p->vma_manager, addr, length, &map_addr) < 0)
       goto err;
   }
 
   // Insert VMA
   if(vma_insert(&p->vma_manager, map_addr, length, offset,
-                prot, flags, f) < 0)
+                f ? length : 0, prot, flags, f) < 0)
     goto err;
 
+  // MAP_POPULATE is best effort: what could not be mapped now faults later
+  if(flags & MAP_POPULATE)
+    uvmpopulate(p, vma_lookup(&p->vma_manager, map_addr));
+
   return map_addr;
 
 err:
@@ -437,41 +497,303 @@ err:
 
 // munmap system call
 // int munmap(void *addr, uint length)
+// Unmap [addr, addr+length) of mmap areas. addr must be page aligned.
+// VMAs are split where the range ends inside them and their pages are
+// freed; holes in the range are skipped.
 uint64
 sys_munmap(void)
 {
-  uint64 addr, length;
+  uint64 addr, length, a, end, lo, hi, vend;
   struct proc *p = myproc();
   struct vma *vma;
-  uint64 va, end;
-  int npages;
+  int found = 0;
 
   if(argaddr(0, &addr) < 0)
     return -1;
   if(argaddr(1, &length) < 0)
     return -1;
 
-  if(addr == 0 || length == 0)
+  if(addr == 0 || addr % PGSIZE || length == 0)
+    return -1;
+  end = PGROUNDUP(addr + length);
+  if(end < addr || end > MAXUVA)
     return -1;
 
-  // Find VMA containing this address
-  vma = vma_lookup(&p->vma_manager, addr);
-  if(vma == 0)
+  // The range may cover several VMAs and the holes between them, but
+  // at least one VMA. The heap's MAP_HEAP VMAs belong to sbrk.
+  for(a = addr; a < end; a = hi){
+    if((vma = vma_lookup(&p->vma_manager, a)) == 0){
+      lo = a;
+      hi = end;
+      vma_hole(&p->vma_manager, a, &lo, &hi);
+      continue;
+    }
+    if(vma->flags & MAP_HEAP)
+      return -1;
+    found = 1;
+    hi = vma->addr + vma->length;
+  }
+  if(!found)
     return -1;
 
-  // Calculate page-aligned range
-  va = PGROUNDDOWN(addr);
-  end = PGROUNDUP(addr + length);
-  npages = (end - va) / PGSIZE;
+  // Cut the VMAs at the range ends so only whole VMAs are inside
+  if(vma_split(&p->vma_manager, addr) < 0 || vma_split(&p->vma_manager, end) < 0)
+    return -1;
+
+  p->vmbusy++;
+  for(a = addr; a < end; a = vend){
+    if((vma = vma_lookup(&p->vma_manager, a)) == 0){
+      lo = a;
+      vend = end;
+      vma_hole(&p->vma_manager, a, &lo, &vend);
+      continue;
+    }
+    vend = vma->addr + vma->length;
+    // Write back dirty pages of a shared file mapping, then free the
+    // pages; ones still mapped elsewhere only lose a reference
+    vma_writeback(p, p->pagetable, vma, a, vend);
+    uvmunmap(p->pagetable, a, (vend - a) / PGSIZE, 1);
+  }
+  sfence_vma_range(p, addr, (end - addr) / PGSIZE);
+  p->vmbusy--;
+
+  vma_remove(&p->vma_manager, addr, end - addr);
+  return 0;
+}
+
+// madvise system call
+// int madvise(void *addr, uint length, int advice)
+// Tell the VM how [addr, addr+length) of the sbrk heap or of mmap
+// areas will be used. addr must be page aligned and every page in the
+// range must belong to the heap or to a VMA.
+//   MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL  set the fault-around
+//     window of the VMAs in the range (split as needed); for the heap
+//     the hint covers the whole heap
+//   MADV_WILLNEED  read in file pages and swapped-out pages now
+//   MADV_DONTNEED  free the pages now; the next access faults in a
+//     zero page, or the file contents again for a file mapping; dirty
+//     pages of MAP_SHARED file mappings are written back first
+uint64
+sys_madvise(void)
+{
+  uint64 addr, length, a, end, vend;
+  int advice, heap = 0;
+  struct proc *p = myproc();
+  struct vma *vma;
 
-  // Unmap pages from page table
-  uvmunmap(p->pagetable, va, npages, 0);
-  uvmunmap(p->kpagetable, va, npages, 0);
+  if(argaddr(0, &addr) < 0 || argaddr(1, &length) < 0 || argint(2, &advice) < 0)
+    return -1;
+  if(addr % PGSIZE || advice < MADV_NORMAL || advice > MADV_DONTNEED)
+    return -1;
+  end = PGROUNDUP(addr + length);
+  if(end < addr || end > MAXUVA)
+    return -1;
 
-  // If entire VMA is unmapped, remove it
-  if(addr <= vma->addr && addr + length >= vma->addr + vma->length) {
-    vma_remove(&p->vma_manager, vma->addr, vma->length);
+  for(a = addr; a < end; a += PGSIZE){
+    if(vma_lookup(&p->vma_manager, a) != 0)
+      continue;
+    if(a >= p->sz)
+      return -1;
+    heap = 1;
   }
 
+  switch(advice){
+  case MADV_NORMAL:
+  case MADV_RANDOM:
+  case MADV_SEQUENTIAL:
+    if(heap)
+      p->heap_advice = advice;
+    if(vma_advise(&p->vma_manager, addr, end - addr, advice) < 0)
+      return -1;
+    break;
+
+  case MADV_WILLNEED:
+    // 匿名页没有内容可读，只处理文件映射和交换出去的页；尽力而为
+    for(a = addr; a < end; a += PGSIZE){
+      pte_t *pte = walk(p->pagetable, a, 0);
+      if(pte != 0 && (*pte & PTE_V))
+        continue;
+      if(pte == 0 || !PTE_SWAPPED(*pte)){
+        vma = vma_lookup(&p->vma_manager, a);
+        if(vma == 0 || vma->f == 0)
+          continue;
+      }
+      if(uvmfault(p, a, 0) < 0)
+        break;
+    }
+    break;
+
+  case MADV_DONTNEED:
+    // 共享文件映射的脏页先写回，否则随 PTE_D 一起丢失
+    p->vmbusy++;
+    for(a = addr; a < end; a = vend){
+      if((vma = vma_lookup(&p->vma_manager, a)) == 0){
+        vend = a + PGSIZE;      // 堆页
+        continue;
+      }
+      vend = vma->addr + vma->length < end ? vma->addr + vma->length : end;
+      vma_writeback(p, p->pagetable, vma, a, vend);
+    }
+    uvmunmap(p->pagetable, addr, (end - addr) / PGSIZE, 1);
+    sfence_vma_range(p, addr, (end - addr) / PGSIZE);
+    p->vmbusy--;
+    break;
+  }
   return 0;
 }
+
+// mprotect system call
+// int mprotect(void *addr, uint length, int prot)
+// Change the protection of [addr, addr+length) of mmap areas and the
+// sbrk heap to prot. addr must be page aligned and every page in the
+// range must belong to the heap or to a VMA. Heap pages in the range
+// are registered as anonymous private VMAs (MAP_HEAP) first, so that
+// later faults follow prot too. VMAs are split at the range ends, the
+// PTEs are rewritten in one pass and the TLB is flushed once.
+// An invalid range changes nothing. Running out of memory for a VMA
+// or for splitting a megapage returns -1 with only part of the range
+// changed, as Linux's mprotect() can; the caller may retry.
+uint64
+sys_mprotect(void)
+{
+  uint64 addr, length, a, end, lo, next;
+  int prot, perm = 0, r = 0;
+  struct proc *p = myproc();
+  struct vma *vma;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &length) < 0 || argint(2, &prot) < 0)
+    return -1;
+  if(addr % PGSIZE || (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)))
+    return -1;
+  end = PGROUNDUP(addr + length);
+  if(end < addr || end > MAXUVA)
+    return -1;
+
+  // 先检查整个范围，参数非法时什么都不改；
+  // 只读打开的文件不能通过共享映射写入
+  for(a = addr; a < end; ){
+    if((vma = vma_lookup(&p->vma_manager, a)) != 0){
+      if((prot & PROT_WRITE) && (vma->flags & MAP_SHARED) &&
+         vma->f && !vma->f->writable)
+        return -1;
+      a = vma->addr + vma->length;
+    } else if(a < p->sz){
+      a += PGSIZE;
+    } else {
+      return -1;
+    }
+  }
+
+  // 范围内的堆页登记为 VMA，之后的缺页按 VMA 的权限处理
+  for(a = addr; a < end; ){
+    if((vma = vma_lookup(&p->vma_manager, a)) != 0){
+      a = vma->addr + vma->length;
+      continue;
+    }
+    for(lo = a; a < end && vma_lookup(&p->vma_manager, a) == 0; a += PGSIZE)
+      ;
+    if(vma_insert(&p->vma_manager, lo, a - lo, 0, 0, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HEAP, 0) < 0 ||
+       vma_advise(&p->vma_manager, lo, a - lo, p->heap_advice) < 0)
+      return -1;
+  }
+
+  if(vma_protect(&p->vma_manager, addr, end - addr, prot) < 0)
+    return -1;
+
+  if(prot & PROT_READ)
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+  p->vmbusy++;
+  for(a = addr; a < end; a = next){
+    vma = vma_lookup(&p->vma_manager, a);
+    next = vma->addr + vma->length < end ? vma->addr + vma->length : end;
+    if(uvmprotect(p->pagetable, a, (next - a) / PGSIZE, perm,
+                  (vma->flags & MAP_SHARED) != 0) < 0){
+      r = -1;
+      break;
+    }
+  }
+  sfence_vma_range(p, addr, (end - addr) / PGSIZE);
+  p->vmbusy--;
+  return r;
+}
+
+// msync system call
+// int msync(void *addr, uint length, int flags)
+// Write the dirty pages of MAP_SHARED file mappings in
+// [addr, addr+length) back to their files. addr must be page aligned
+// and the whole range must be mapped. Other mappers already share the
+// same pages, so MS_INVALIDATE has nothing left to do, and MS_ASYNC
+// is carried out synchronously like MS_SYNC.
+uint64
+sys_msync(void)
+{
+  uint64 addr, length, a, end;
+  int flags, r = 0;
+  struct proc *p = myproc();
+  struct vma *vma;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &length) < 0 || argint(2, &flags) < 0)
+    return -1;
+  if(addr % PGSIZE || (flags & ~(MS_ASYNC | MS_INVALIDATE | MS_SYNC)))
+    return -1;
+  if((flags & MS_ASYNC) && (flags & MS_SYNC))
+    return -1;
+  end = PGROUNDUP(addr + length);
+  if(end < addr || end > MAXUVA)
+    return -1;
+
+  for(a = addr; a < end; a = vma->addr + vma->length)
+    if((vma = vma_lookup(&p->vma_manager, a)) == 0)
+      return -1;
+  p->vmbusy++;
+  for(a = addr; a < end; a = vma->addr + vma->length){
+    vma = vma_lookup(&p->vma_manager, a);
+    if(vma_writeback(p, p->pagetable, vma, a, end) < 0)
+      r = -1;
+  }
+  p->vmbusy--;
+  return r;
+}
+
+// faultaround system call
+// int faultaround(int npages)
+// Set how many pages a lazy heap or anonymous mmap fault maps at once.
+// 1 disables fault-around, 0 restores the default, a negative value
+// only queries. Returns the previous window.
+uint64
+sys_faultaround(void)
+{
+  int n;
+  struct proc *p = myproc();
+  int old = p->fault_around;
+
+  if(argint(0, &n) < 0)
+    return -1;
+
+  if(n == 0)
+    p->fault_around = FAULT_AROUND;
+  else if(n > 0)
+    p->fault_around = n < FAULT_AROUND_MAX ? n : FAULT_AROUND_MAX;
+
+  return old;
+}
+
+// ksm system call
+// int ksm(int on)
+// Switch the same-page merging scanner on (1) or off (0) for the
+// whole system; a negative value only queries. Returns the previous
+// setting.
+uint64
+sys_ksm(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  return ksm_set(on);
+}
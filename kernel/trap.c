@@ -4,6 +4,7 @@
 #include "include/riscv.h"
 #include "include/spinlock.h"
 #include "include/proc.h"
+#include "include/asid.h"
 #include "include/sbi.h"
 #include "include/plic.h"
 #include "include/trap.h"
@@ -15,6 +16,7 @@
 #include "include/disk.h"
 #include "include/vm.h"
 #include "include/vma.h"
+#include "include/swap.h"
 
 extern char trampoline[], uservec[], userret[];
 
@@ -92,62 +94,17 @@ usertrap(void)
   }
    else if((which_dev = devintr()) != 0){
     // ok
-  } else if(r_scause() == 13 || r_scause() == 15){
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // 缺页：COW、懒分配、文件映射、换入都由 uvmfault() 处理，
+    // 失败说明访问非法或内存不足。正常返回后用户态重试该指令
     uint64 va = r_stval();
-    uint64 a  = PGROUNDDOWN(va);
-
-    // 1) COW 优先：通常只有写 fault（15）需要 COW 修复
-    if(r_scause() == 15 && is_cow_page(p->pagetable, a)){
-      if(cow_alloc(p->pagetable, a) < 0)
-        p->killed = 1;
-      goto done_pf;
-    }
-
-    // 2) VMA (mmap) 检查：检查是否在 mmap 区域
-    struct vma *vma = vma_lookup(&p->vma_manager, a);
-    if(vma != 0) {
-      // 在 VMA 区域，分配页面
-      // 检查权限
-      int perm = PTE_U;
-      if(vma->prot & PROT_READ)
-        perm |= PTE_R;
-      if(vma->prot & PROT_WRITE)
-        perm |= PTE_W;
-      if(vma->prot & PROT_EXEC)
-        perm |= PTE_X;
-
-      // MAP_PRIVATE 使用 COW
-      if(vma->flags & MAP_PRIVATE)
-        perm = (perm | PTE_COW) & ~PTE_W;
-
-      // 懒惰分配页面
-      if(lazy_alloc(p->pagetable, p->kpagetable, a) < 0) {
-        p->killed = 1;
-        goto done_pf;
-      }
-
-      // 更新页面权限
-      pte_t *pte = walk(p->pagetable, a, 0);
-      if(pte != 0) {
-        *pte = (*pte & ~(PTE_R | PTE_W | PTE_X)) | perm;
-      }
-      goto done_pf;
-    }
-
-    // 3) lazy allocation：只允许补"已通过 sbrk 扩过的范围"
-    if(a >= p->sz || a >= MAXUVA){
+    int write = r_scause() == 15;
+    intr_on();  // 处理缺页可能要读写磁盘
+    swap_balance();
+    // 内存不足时换出一批页再试一次，实在不行才杀掉进程
+    if(uvmfault(p, va, write) < 0 &&
+       (swap_balance() == 0 || uvmfault(p, va, write) < 0))
       p->killed = 1;
-      goto done_pf;
-    }
-
-    if(lazy_alloc(p->pagetable, p->kpagetable, a) < 0){
-      p->killed = 1; // OOM 或映射失败
-      goto done_pf;
-    }
-
-  done_pf:
-  ;
-    // 正常返回，让用户态重试该指令
   }
   else {
     printf("\nusertrap(): unexpected scause %p pid=%d %s\n", r_scause(), p->pid, p->name);
@@ -197,7 +154,7 @@ usertrapret(void)
 
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_satp = r_satp();         // unused: the kernel runs on p->pagetable
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -214,15 +171,27 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  // printf("[usertrapret]p->pagetable: %p\n", p->pagetable);
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // the user page table is already in satp: it maps the kernel
+  // half too, so there is no page table switch on the way out.
 
   // jump to trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // restores user registers, and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64))fn)(TRAPFRAME);
+}
+
+// Page fault in uaccess_copy(). uvmfault() may sleep (swap in, read
+// the file), so run it with interrupts on, as usertrap() runs system
+// calls; the caller restores sepc and sstatus afterwards.
+static int
+kernel_uaccess_fault(struct proc *p, uint64 va, int write)
+{
+  int r;
+
+  intr_on();
+  r = uvmfault(p, va, write);
+  intr_off();
+  return r;
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -239,6 +208,19 @@ kerneltrap() {
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
+  // 内核经 SUM 直接访问用户页时缺页：copyin2()/copyout2() 预缺页之后，
+  // 该页又在本进程被抢占期间被换出了。换回来后重试这条指令。
+  // 只处理 uaccess_copy() 里、没有持有自旋锁时的缺页：uvmfault() 可能
+  // 睡眠；其他内核代码访问低地址是 bug，照常 panic
+  if((scause == 13 || scause == 15) && r_stval() < MAXUVA &&
+     (sstatus & SSTATUS_SUM) && myproc() != 0 && myproc()->uaccess &&
+     mycpu()->noff == 0 &&
+     kernel_uaccess_fault(myproc(), r_stval(), scause == 15) == 0){
+    w_sepc(sepc);
+    w_sstatus(sstatus);
+    return;
+  }
+
   if((which_dev = devintr()) == 0){
     printf("\nscause %p\n", scause);
     printf("sepc=%p stval=%p hart=%d\n", r_sepc(), r_stval(), r_tp());
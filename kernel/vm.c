@@ -5,9 +5,13 @@
 #include "include/riscv.h"
 #include "include/vm.h"
 #include "include/kalloc.h"
+#include "include/intr.h"
 #include "include/proc.h"
 #include "include/printf.h"
 #include "include/string.h"
+#include "include/asid.h"
+#include "include/vma.h"
+#include "include/swap.h"
 
 // 引用计数函数的前向声明
 void incref(uint64 pa);
@@ -19,6 +23,11 @@ int getref(uint64 pa);
  */
 pagetable_t kernel_pagetable;
 
+// 全局只读零页：未写过的堆 / 匿名页的读缺页都映射到它（带 PTE_COW），
+// 第一次写时由 cow_alloc() 换成私有页。内核自己持有一个引用，
+// 所以它的引用计数永远不会降到 0。
+uint64 zero_page;
+
 extern char etext[];  // kernel.ld sets this to end of kernel code.
 extern char trampoline[]; // trampoline.S
 /*
@@ -32,6 +41,10 @@ kvminit()
 
   memset(kernel_pagetable, 0, PGSIZE);
 
+  zero_page = (uint64)kalloc_zeroed();
+  if(zero_page == 0)
+    panic("kvminit: zero page");
+
   // uart registers
   kvmmap(UART_V, UART, PGSIZE, PTE_R | PTE_W);
   
@@ -81,10 +94,13 @@ kvminit()
   // map kernel text executable and read-only.
   kvmmap(KERNBASE, KERNBASE, (uint64)etext - KERNBASE, PTE_R | PTE_X);
   // map kernel data and the physical RAM we'll make use of.
+  // kvmmap() uses megapages for the 2 MiB aligned part.
   kvmmap((uint64)etext, (uint64)etext, PHYSTOP - (uint64)etext, PTE_R | PTE_W);
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
-  kvmmap(TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
+  // not global: user page tables map their own trampoline slot.
+  if(mappages(kernel_pagetable, TRAMPOLINE, PGSIZE, (uint64)trampoline, PTE_R | PTE_X) != 0)
+    panic("kvminit");
 
   #ifdef DEBUG
   printf("kvminit\n");
@@ -99,6 +115,13 @@ kvminithart()
   w_satp(MAKE_SATP(kernel_pagetable));
   // reg_info();
   sfence_vma();
+  // the kernel runs on the user page table while serving a process
+  // and touches user pages (PTE_U) directly, which needs SUM.
+  // k210 implements priv spec 1.9.1, where this bit is PUM with the
+  // opposite meaning and already clear, so leave it alone there.
+  #ifdef QEMU
+  w_sstatus(r_sstatus() | SSTATUS_SUM);
+  #endif
   #ifdef DEBUG
   printf("kvminithart\n");
   #endif
@@ -116,27 +139,99 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A level-1 leaf maps a whole megapage. With alloc!=0 it is split
+// into 512 ordinary PTEs first, so the caller always gets a level-0
+// PTE it may change; without alloc the megapage PTE itself is
+// returned, see walksize().
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walksize(pagetable, va, alloc, NULL);
+}
+
+// Like walk(), and also store the size of the page the returned
+// PTE maps in *size: PGSIZE, or MEGAPGSIZE for a megapage leaf.
+pte_t *
+walksize(pagetable_t pagetable, uint64 va, int alloc, uint64 *size)
 {
   
   if(va >= MAXVA)
     panic("walk");
 
+  if(size)
+    *size = PGSIZE;
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) && PTE_LEAF(*pte) && level == 1) {
+      if(!alloc) {
+        if(size)
+          *size = MEGAPGSIZE;
+        return pte;
+      }
+      if(megapage_split(pte) < 0)
+        return NULL;
+    }
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == NULL)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == NULL)
         return NULL;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Replace the megapage leaf *pte with a level-0 table of 512 PTEs
+// mapping the same memory with the same permissions. The pages of a
+// megapage come from kalloc_pages() and are refcounted one by one,
+// so they can be unmapped or copied on write individually afterwards.
+// The translations don't change, so no TLB flush is needed.
+// Returns 0 on success, -1 if out of memory.
+int
+megapage_split(pte_t *pte)
+{
+  pagetable_t pt;
+  uint64 pa = PTE2PA(*pte);
+  uint64 flags = PTE_FLAGS(*pte);
+
+  if((pt = (pagetable_t)kalloc()) == NULL)
+    return -1;
+  for(int i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + (uint64)i * PGSIZE) | flags;
+  *pte = PA2PTE(pt) | PTE_V;
+  return 0;
+}
+
+// Map the megapage at va (MEGAPGSIZE aligned) to physical address pa
+// with a single level-1 leaf PTE. The range must be unmapped and no
+// level-0 table may exist for it yet.
+// Returns 0 on success, -1 if out of memory or the slot is in use.
+int
+mapmegapage(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte = &pagetable[PX(2, va)];
+
+  if((va % MEGAPGSIZE) != 0 || (pa % MEGAPGSIZE) != 0)
+    panic("mapmegapage: not aligned");
+  if((perm & (PTE_R|PTE_W|PTE_X)) == 0)
+    panic("mapmegapage: not a leaf");
+
+  if(*pte & PTE_V) {
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if((pagetable = (pde_t*)kalloc_zeroed()) == NULL)
+      return -1;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  pte = &pagetable[PX(1, va)];
+  if(*pte & PTE_V)
+    return -1;
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -149,24 +244,43 @@ walkaddr(pagetable_t pagetable, uint64 va)
   if(va >= MAXVA)
     return NULL;
 
-  pte = walk(pagetable, va, 0);
+  uint64 size;
+  pte = walksize(pagetable, va, 0, &size);
   if(pte == 0)
     return NULL;
   if((*pte & PTE_V) == 0)
     return NULL;
   if((*pte & PTE_U) == 0)
     return NULL;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (size - 1));
   return pa;
 }
 
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
+// kernel mappings are identical in every address space,
+// so they are global and survive ASID-scoped flushes.
+// the 2 MiB aligned middle of a large region is mapped with
+// megapages, the unaligned head and tail with 4 KiB pages.
 void
 kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kernel_pagetable, va, sz, pa, perm) != 0)
+  uint64 end = va + sz;
+  uint64 mstart = MEGAPGROUNDUP(va);
+  uint64 mend = MEGAPGROUNDDOWN(end);
+
+  if((va - pa) % MEGAPGSIZE != 0 || mstart >= mend){
+    if(mappages(kernel_pagetable, va, sz, pa, perm | PTE_G) != 0)
+      panic("kvmmap");
+    return;
+  }
+  if(mstart > va && mappages(kernel_pagetable, va, mstart - va, pa, perm | PTE_G) != 0)
+    panic("kvmmap");
+  for(uint64 a = mstart; a < mend; a += MEGAPGSIZE)
+    if(mapmegapage(kernel_pagetable, a, pa + (a - va), perm | PTE_G) != 0)
+      panic("kvmmap");
+  if(end > mend && mappages(kernel_pagetable, mend, end - mend, pa + (mend - va), perm | PTE_G) != 0)
     panic("kvmmap");
 }
 
@@ -183,17 +297,17 @@ kvmpa(uint64 va)
 uint64
 kwalkaddr(pagetable_t kpt, uint64 va)
 {
-  uint64 off = va % PGSIZE;
+  uint64 size;
   pte_t *pte;
   uint64 pa;
   
-  pte = walk(kpt, va, 0);
+  pte = walksize(kpt, va, 0, &size);
   if(pte == 0)
     panic("kvmpa");
   if((*pte & PTE_V) == 0)
     panic("kvmpa");
   pa = PTE2PA(*pte);
-  return pa+off;
+  return pa + (va & (size - 1));
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -223,6 +337,20 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Unmapping [a, end) hit the megapage leaf *pte. If the whole
+// megapage lies inside the range, drop it with one PTE write and
+// return 1; otherwise return 0 and let the caller split it.
+static int
+megapage_unmap(pte_t *pte, uint64 a, uint64 end, int do_free)
+{
+  if((a % MEGAPGSIZE) != 0 || a + MEGAPGSIZE > end)
+    return 0;
+  if(do_free)
+    kfree_pages((void*)PTE2PA(*pte), MEGAPGORDER);
+  *pte = 0;
+  return 1;
+}
+
 // Remove npages of mappings starting from va. va must be
 // page-aligned. The mappings must exist.
 // Optionally free the physical memory.
@@ -233,11 +361,26 @@ vmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("vmunmap: not aligned");
 
   for(uint64 a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    pte_t *pte = walk(pagetable, a, 0);
+    uint64 size;
+    pte_t *pte = walksize(pagetable, a, 0, &size);
     if(pte == 0)
       continue;                 // lazy 空洞：页表路径都不存在
-    if((*pte & PTE_V) == 0)
+    if((*pte & PTE_V) == 0){
+      if(PTE_SWAPPED(*pte)){
+        swap_free(*pte);        // 交换槽只属于这个 PTE
+        *pte = 0;
+      }
       continue;                 // lazy 空洞：pte 无效
+    }
+
+    if(size == MEGAPGSIZE){
+      if(megapage_unmap(pte, a, va + npages*PGSIZE, do_free)){
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if((pte = walk(pagetable, a, 1)) == 0)
+        continue;               // 内存不足无法拆分：保留这一页的映射
+    }
 
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("vmunmap: not a leaf");
@@ -263,11 +406,26 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
     panic("uvmunmap: not aligned");
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    pte = walk(pagetable, a, 0);
+    uint64 size;
+    pte = walksize(pagetable, a, 0, &size);
     if(pte == 0)
       continue;                 // lazy: 该页表分支都不存在，跳过
-    if((*pte & PTE_V) == 0)
+    if((*pte & PTE_V) == 0){
+      if(PTE_SWAPPED(*pte)){
+        swap_free(*pte);        // 交换槽只属于这个 PTE
+        *pte = 0;
+      }
       continue;                 // lazy: 该页未映射，跳过
+    }
+
+    if(size == MEGAPGSIZE){
+      if(megapage_unmap(pte, a, va + npages*PGSIZE, do_free)){
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if((pte = walk(pagetable, a, 1)) == 0)
+        continue;               // 内存不足无法拆分：保留这一页的映射
+    }
 
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
@@ -281,15 +439,20 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 }
 
 // create an empty user page table.
+// the kernel half shares kernel_pagetable's level-1 tables, so the
+// kernel keeps running on this table after a trap. all of those
+// top-level entries are created at boot and never change afterwards.
+// the top slot is left private for the trampoline and trapframe.
 // returns 0 if out of memory.
 pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == NULL)
     return NULL;
-  memset(pagetable, 0, PGSIZE);
+  for(int i = PX(2, MAXUVA); i < PX(2, TRAMPOLINE); i++)
+    pagetable[i] = kernel_pagetable[i];
   return pagetable;
 }
 
@@ -297,17 +460,15 @@ uvmcreate()
 // for the very first process.
 // sz must be less than a page.
 void
-uvminit(pagetable_t pagetable, pagetable_t kpagetable, uchar *src, uint sz)
+uvminit(pagetable_t pagetable, uchar *src, uint sz)
 {
   char *mem;
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
+  mem = kalloc_zeroed();
   // printf("[uvminit]kalloc: %p\n", mem);
-  memset(mem, 0, PGSIZE);
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
-  mappages(kpagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X);
   memmove(mem, src, sz);
   // for (int i = 0; i < sz; i ++) {
   //   printf("[uvminit]mem: %p, %x\n", mem + i, mem[i]);
@@ -317,7 +478,7 @@ uvminit(pagetable_t pagetable, pagetable_t kpagetable, uchar *src, uint sz)
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 uint64
-uvmalloc(pagetable_t pagetable, pagetable_t kpagetable, uint64 oldsz, uint64 newsz)
+uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
   char *mem;
   uint64 a;
@@ -327,21 +488,14 @@ uvmalloc(pagetable_t pagetable, pagetable_t kpagetable, uint64 oldsz, uint64 new
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == NULL){
-      uvmdealloc(pagetable, kpagetable, a, oldsz);
+      uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0) {
       kfree(mem);
-      uvmdealloc(pagetable, kpagetable, a, oldsz);
-      return 0;
-    }
-    if (mappages(kpagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R) != 0){
-      int npages = (a - oldsz) / PGSIZE;
-      vmunmap(pagetable, oldsz, npages + 1, 1);   // plus the page allocated above.
-      vmunmap(kpagetable, oldsz, npages, 0);
+      uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
   }
@@ -353,7 +507,7 @@ uvmalloc(pagetable_t pagetable, pagetable_t kpagetable, uint64 oldsz, uint64 new
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
 uint64
-uvmdealloc(pagetable_t pagetable, pagetable_t kpagetable, uint64 oldsz, uint64 newsz)
+uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
   if(newsz >= oldsz)
     return oldsz;
@@ -364,12 +518,9 @@ uvmdealloc(pagetable_t pagetable, pagetable_t kpagetable, uint64 oldsz, uint64 n
   if(newup < oldup){
     uint64 npages = (oldup - newup) / PGSIZE;
 
-    // 先去掉内核页表映射（不释放物理页）
-    if(kpagetable)
-      uvmunmap(kpagetable, newup, npages, 0);
-
-    // 再去掉用户页表映射（释放物理页）
+    // 去掉用户页表映射（释放物理页）
     uvmunmap(pagetable, newup, npages, 1);
+    sfence_vma_range(myproc(), newup, npages);
   }
 
   return newsz;
@@ -402,6 +553,9 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 {
   if(sz > 0)
     vmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  // the kernel half belongs to kernel_pagetable, see uvmcreate().
+  for(int i = PX(2, MAXUVA); i < PX(2, TRAMPOLINE); i++)
+    pagetable[i] = 0;
   freewalk(pagetable);
 }
 
@@ -412,43 +566,93 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, pagetable_t knew, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  for(uint64 i = 0; i < sz; i += PGSIZE){
-    pte_t *pte = walk(old, i, 0);
+  return uvmcopyrange(old, new, 0, PGROUNDUP(sz), 0);
+}
+
+// 把 old 中 [start, end) 的映射复制到 new（fork 使用），两边共用物理页。
+// 私有内存的可写页在父子双方都改为 COW；shared 表示 MAP_SHARED 区域，
+// 子进程直接映射同一页，保留写权限，PTE_D 只留在父进程（由它写回）。
+// 完整落在范围内的 megapage 整块共享，否则先拆成 4K 页。
+// 成功返回 0；失败返回 -1，并撤销 new 中这个范围已建立的映射。
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end,
+             int shared)
+{
+  int downgraded = 0;   // 父进程中被改为只读的页数
+
+  for(uint64 i = start; i < end; i += PGSIZE){
+    uint64 size;
+    pte_t *pte = walksize(old, i, 0, &size);
     if(pte == 0)
       continue;                   // lazy 空洞
+    if(size == MEGAPGSIZE){
+      if(i % MEGAPGSIZE == 0 && i + MEGAPGSIZE <= end){
+        uint64 pa = PTE2PA(*pte);
+        uint flags = PTE_FLAGS(*pte) & ~PTE_V;
+        if(shared){
+          flags &= ~PTE_D;
+        } else if(flags & PTE_W){
+          flags = (flags | PTE_COW) & ~PTE_W;
+          *pte = PA2PTE(pa) | flags | PTE_V;
+          downgraded++;
+        }
+        if(mapmegapage(new, i, pa, flags) != 0)
+          goto err;
+        for(int j = 0; j < MEGAPGSIZE / PGSIZE; j++)
+          incref(pa + (uint64)j * PGSIZE);
+        i += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if((pte = walk(old, i, 1)) == 0)
+        goto err;                 // 拆分 megapage 时内存不足
+    }
+    if(PTE_SWAPPED(*pte)){
+      // 换出的页：子进程共用同一个交换槽，各自换入时得到私有副本
+      pte_t *npte = walk(new, i, 1);
+      if(npte == 0)
+        goto err;
+      swap_dup(*pte);
+      *npte = *pte;
+      continue;
+    }
     if((*pte & PTE_V) == 0)
       continue;                   // lazy 空洞
 
     uint64 pa = PTE2PA(*pte);
     uint flags = PTE_FLAGS(*pte);
 
-    // 对可写页启用 COW：子进程映射同一物理页，双方清写位、置 COW
-    if(flags & PTE_W){
+    // 共享区域原样映射；私有的可写页启用 COW：子进程映射同一物理页，
+    // 双方清写位、置 COW
+    if(shared){
+      flags &= ~PTE_D;
+    } else if(flags & PTE_W){
       flags = (flags | PTE_COW) & ~PTE_W;
 
       if((*pte & PTE_COW) == 0){
         uint parent_flags = (PTE_FLAGS(*pte) | PTE_COW) & ~PTE_W;
         *pte = PA2PTE(pa) | parent_flags | PTE_V;
+        downgraded++;
       }
     }
 
-    if(mappages(new, i, PGSIZE, pa, flags | PTE_U) != 0)
-      goto err;
-    if(mappages(knew, i, PGSIZE, pa, flags | PTE_U) != 0)
+    // 不补 PTE_U：栈保护页和 PROT_NONE 的页在子进程中同样不可访问
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
 
     incref(pa);
   }
 
-  sfence_vma();
+  if(downgraded)
+    sfence_vma_range(myproc(), start, (end - start) / PGSIZE);
   return 0;
 
 err:
   // 释放已建立的映射（do_free=1 交给 kfree/refcount）
-  vmunmap(new, 0, PGROUNDUP(sz)/PGSIZE, 1);
-  vmunmap(knew, 0, PGROUNDUP(sz)/PGSIZE, 0); // knew 的物理页由 new 那侧 kfree/refcount 处理
+  vmunmap(new, start, (end - start) / PGSIZE, 1);
+  if(downgraded)
+    sfence_vma_range(myproc(), start, (end - start) / PGSIZE);
   return -1;
 }
 
@@ -465,6 +669,64 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// mprotect 的新 PTE：只改 R/W/X/U/COW 位，换出的 PTE 同样适用。
+// perm 是 PTE_R/W/X 的组合，0 表示 PROT_NONE：像栈保护页一样
+// 清掉 PTE_U，保留 PTE_R 使它仍是叶子，页面内容不丢。
+// 要求可写时，原本可写的页保持可写；私有映射中原本只读的页改成
+// PTE_COW，第一次写时由 cow_alloc() 复制或直接复用；共享映射除了
+// zero_page 都直接可写。
+static pte_t
+protect_pte(pte_t e, int perm, int shared)
+{
+  pte_t n = e & ~(PTE_R | PTE_W | PTE_X | PTE_U | PTE_COW);
+
+  if((perm & (PTE_R | PTE_W | PTE_X)) == 0)
+    return n | PTE_R;
+  n |= (perm & (PTE_R | PTE_X)) | PTE_U;
+  if(perm & PTE_W){
+    n |= PTE_R;                 // 没有只写的叶子 PTE
+    if(e & PTE_W)
+      n |= PTE_W;
+    else if(shared && (e & PTE_COW) == 0 &&
+            !((e & PTE_V) && PTE2PA(e) == zero_page))
+      n |= PTE_W;
+    else
+      n |= PTE_COW;
+  }
+  return n;
+}
+
+// 一次遍历把 [va, va + npages*PGSIZE) 中已映射和已换出的页的权限
+// 改为 perm（见 protect_pte），未映射的页留给缺页按 VMA 处理。
+// 整块落在范围内的 megapage 直接改叶子，否则先拆成 4K 页。
+// 不刷新 TLB，由调用者对整个范围刷新一次。内存不足无法拆分时返回 -1。
+int
+uvmprotect(pagetable_t pagetable, uint64 va, uint64 npages, int perm, int shared)
+{
+  uint64 a, end = va + npages * PGSIZE, size;
+  pte_t *pte;
+
+  for(a = va; a < end; a += PGSIZE){
+    pte = walksize(pagetable, a, 0, &size);
+    if(pte == 0){
+      a = MEGAPGROUNDDOWN(a) + MEGAPGSIZE - PGSIZE;
+      continue;                 // no level-0 table here
+    }
+    if(size == MEGAPGSIZE){
+      if(a == MEGAPGROUNDDOWN(a) && a + MEGAPGSIZE <= end){
+        *pte = protect_pte(*pte, perm, shared);
+        a += MEGAPGSIZE - PGSIZE;
+        continue;
+      }
+      if((pte = walk(pagetable, a, 1)) == 0)
+        return -1;
+    }
+    if((*pte & PTE_V) || PTE_SWAPPED(*pte))
+      *pte = protect_pte(*pte, perm, shared);
+  }
+  return 0;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -486,9 +748,9 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0){
-      // 若目标地址在进程逻辑大小内，则尝试 lazy 分配
-      if(va0 < p->sz && va0 < MAXUVA){
-        if(lazy_alloc(p->pagetable, p->kpagetable, va0) < 0)
+      // 当前进程的页表：按缺页处理（懒分配或从文件读入）
+      if(pagetable == p->pagetable){
+        if(uvmfault(p, va0, 1) < 0)
           return -1;
         pa0 = walkaddr(pagetable, va0);
       }
@@ -509,6 +771,69 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
   return 0;
 }
 
+// Make every page of [va, va+len) in the current process present,
+// faulting them in like usertrap() would, and break COW first if the
+// kernel is going to write. Afterwards the kernel, which is running
+// on p->pagetable, can access the range directly thanks to SUM.
+// Return 0 on success, -1 on error.
+static int
+uvmprefault(struct proc *p, uint64 va, uint64 len, int write)
+{
+  uint64 a, end;
+
+  if(va + len < va || va + len > MAXUVA)
+    return -1;
+  end = va + len;
+  // 回收会睡眠并获取进程锁：调用者不能持有任何自旋锁
+  push_off();
+  if(mycpu()->noff != 1)
+    panic("uvmprefault: holding a spinlock");
+  pop_off();
+  swap_balance();
+  // swap_balance() 只会扫描 p 自己：循环里调用它时没有持有任何 PTE
+  p->vmbusy++;
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    pte_t *pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0){
+      // 可能是内存不足：换出一批页后再试一次
+      if(uvmfault(p, a, write) < 0 &&
+         (swap_balance() == 0 || uvmfault(p, a, write) < 0))
+        goto bad;
+      pte = walk(p->pagetable, a, 0);
+    }
+    if((*pte & PTE_U) == 0)
+      goto bad;                 // e.g. the stack guard page
+    if(!write && (*pte & PTE_R) == 0)
+      goto bad;                 // execute-only
+    if(write && (*pte & PTE_COW)){
+      if(cow_alloc(p->pagetable, a) < 0)
+        goto bad;
+    } else if(write && (*pte & PTE_W) == 0){
+      goto bad;
+    }
+  }
+  p->vmbusy--;
+  return 0;
+
+bad:
+  p->vmbusy--;
+  return -1;
+}
+
+// memmove() between the kernel and the current process's user pages,
+// which the kernel reaches directly through SUM. uvmprefault() made
+// them present, but p may be preempted here and have them swapped
+// out meanwhile; kerneltrap() fixes up such faults only while
+// p->uaccess is set.
+static void
+uaccess_copy(struct proc *p, void *dst, const void *src, uint64 len)
+{
+  p->uaccess = 1;
+  memmove(dst, src, len);
+  p->uaccess = 0;
+}
+
+// Copy to the current process's user space at dstva.
 int
 copyout2(uint64 dstva, void *src, uint64 len)
 {
@@ -517,7 +842,10 @@ copyout2(uint64 dstva, void *src, uint64 len)
     return -1;
   if(dstva >= p->sz || dstva + len > p->sz)
     return -1;
-  return copyout(p->pagetable, dstva, (char*)src, len);
+  if(uvmprefault(p, dstva, len, 1) < 0)
+    return -1;
+  uaccess_copy(p, (void *)dstva, src, len);
+  return 0;
 }
 
 // Copy from user to kernel.
@@ -533,8 +861,8 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0){
-      if(va0 < p->sz && va0 < MAXUVA){
-        if(lazy_alloc(p->pagetable, p->kpagetable, va0) < 0)
+      if(pagetable == p->pagetable){
+        if(uvmfault(p, va0, 0) < 0)
           return -1;
         pa0 = walkaddr(pagetable, va0);
       }
@@ -555,10 +883,15 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// Copy from the current process's user space at srcva.
 int
 copyin2(void *dst, uint64 srcva, uint64 len)
 {
-  return copyin(myproc()->pagetable, dst, srcva, len);
+  struct proc *p = myproc();
+  if(uvmprefault(p, srcva, len, 0) < 0)
+    return -1;
+  uaccess_copy(p, dst, (void *)srcva, len);
+  return 0;
 }
 
 // Copy a null-terminated string from user to kernel.
@@ -576,8 +909,8 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
     if(pa0 == 0){
-      if(va0 < p->sz && va0 < MAXUVA){
-        if(lazy_alloc(p->pagetable, p->kpagetable, va0) < 0)
+      if(pagetable == p->pagetable){
+        if(uvmfault(p, va0, 0) < 0)
           return -1;
         pa0 = walkaddr(pagetable, va0);
       }
@@ -609,6 +942,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   return -1;
 }
 
+// Copy a null-terminated string from the current process's user space.
 int
 copyinstr2(char *dst, uint64 srcva, uint64 max)
 {
@@ -617,12 +951,53 @@ copyinstr2(char *dst, uint64 srcva, uint64 max)
     return -1;
   if(srcva >= p->sz)
     return -1;
-  return copyinstr(p->pagetable, dst, srcva, max);
+
+  while(max > 0){
+    uint64 va0 = PGROUNDDOWN(srcva);
+    uint64 n = PGSIZE - (srcva - va0);
+    if(n > max)
+      n = max;
+    if(uvmprefault(p, srcva, n, 0) < 0)
+      return -1;
+
+    char *s = (char *)srcva;
+    p->uaccess = 1;
+    for(uint64 i = 0; i < n; i++){
+      dst[i] = s[i];
+      if(s[i] == '\0'){
+        p->uaccess = 0;
+        return 0;
+      }
+    }
+    p->uaccess = 0;
+
+    max -= n;
+    dst += n;
+    srcva += n;
+  }
+  return -1;
+}
+
+// COW 缺页统计：复制了页面 / 直接复用 / 从零页换成新页
+static struct {
+  uint64 copy;
+  uint64 reuse;
+  uint64 zero;
+} cowstat;
+
+// 读取 COW 统计信息，不加锁读取，仅供参考
+void
+cow_stat(uint64 *copy, uint64 *reuse, uint64 *zero)
+{
+  *copy = cowstat.copy;
+  *reuse = cowstat.reuse;
+  *zero = cowstat.zero;
 }
 
 // 处理写时复制页面分配
 // 当尝试写入COW页面时调用
-// 分配新页面并复制内容
+// 若当前进程是该页唯一的持有者，直接恢复写权限；
+// 否则分配新页面并复制内容
 // 成功返回0，失败返回-1
 int
 cow_alloc(pagetable_t pagetable, uint64 va)
@@ -638,7 +1013,8 @@ cow_alloc(pagetable_t pagetable, uint64 va)
   va = PGROUNDDOWN(va);
 
   // 查找PTE
-  pte = walk(pagetable, va, 0);
+  uint64 size;
+  pte = walksize(pagetable, va, 0, &size);
   if(pte == 0 || (*pte & PTE_V) == 0)
     return -1;
 
@@ -646,40 +1022,53 @@ cow_alloc(pagetable_t pagetable, uint64 va)
   if((*pte & PTE_COW) == 0)
     return -1;  // 不是COW页面
 
+  // megapage 先拆成 4K 页，只复制被写的这一页
+  if(size == MEGAPGSIZE && (pte = walk(pagetable, va, 1)) == 0)
+    return -1;
+
   pa = PTE2PA(*pte);
   flags = PTE_FLAGS(*pte);
 
-  // 分配一个新页面
-  new_mem = kalloc();
+  // 其他共享者已经退出或已经复制过：这一页只剩我们在用，
+  // 不必复制。只有持有映射的进程才能增加引用（fork），
+  // 而它此刻正在处理这次缺页，所以计数不会在检查后变大。
+  if(pa != zero_page && getref(pa) == 1){
+    *pte = PA2PTE(pa) | ((flags | PTE_W) & ~PTE_COW) | PTE_V;
+    sfence_vma_range(myproc(), va, 1);
+    __sync_fetch_and_add(&cowstat.reuse, 1);
+    return 0;
+  }
+
+  // 分配一个新页面；零页不必复制，直接取一个清零的页
+  if(pa == zero_page)
+    new_mem = kalloc_zeroed();
+  else
+    new_mem = kalloc();
   if(new_mem == 0)
     return -1;
 
   new_pa = (uint64)new_mem;
 
   // 复制页面内容
-  memmove((void*)new_pa, (void*)pa, PGSIZE);
+  if(pa != zero_page){
+    memmove((void*)new_pa, (void*)pa, PGSIZE);
+    __sync_fetch_and_add(&cowstat.copy, 1);
+  } else {
+    __sync_fetch_and_add(&cowstat.zero, 1);
+  }
 
-  // 更新引用计数
-  decref(pa);
+  // 减少旧页的引用计数；若其他共享者已经退出，这里就是最后一个引用，
+  // kfree 会原子地减到 0 并释放，否则页面会泄漏
+  kfree((void*)pa);
 
   // 清除COW标志并添加写权限
   flags = (flags | PTE_W) & ~PTE_COW;
 
-  // 在用户和内核页表中都映射新页面
+  // 映射新页面
   *pte = PA2PTE(new_pa) | flags | PTE_V;
 
-  // 同时更新内核页表映射
-  // 内核页表不需要COW，直接添加写权限
-  struct proc *p = myproc();
-  if(p != 0) {
-    pte_t *kpte = walk(p->kpagetable, va, 0);
-    if(kpte != 0 && (*kpte & PTE_V)) {
-      *kpte = PA2PTE(new_pa) | (flags & ~PTE_U & ~PTE_COW) | PTE_W | PTE_V;
-    }
-  }
-
   // 刷新TLB
-  sfence_vma();
+  sfence_vma_range(myproc(), va, 1);
 
   return 0;
 }
@@ -701,99 +1090,305 @@ is_cow_page(pagetable_t pagetable, uint64 va)
 }
 
 
-int
-lazy_alloc(pagetable_t pagetable, pagetable_t kpagetable, uint64 va)
+// VMA 的保护标志对应的叶子 PTE 权限。
+// MAP_PRIVATE 的可写区域使用 COW；只读映射不能靠 COW 变成可写
+static int
+vma_perm(struct vma *vma)
+{
+  int perm = PTE_U;
+
+  if(vma->prot & PROT_READ)
+    perm |= PTE_R;
+  if(vma->prot & PROT_WRITE)
+    perm |= PTE_R | PTE_W;      // 没有只写的叶子 PTE
+  if(vma->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if((vma->flags & MAP_PRIVATE) && (perm & PTE_W))
+    perm = (perm | PTE_COW) & ~PTE_W;
+  return perm;
+}
+
+// uvmfault() 的主体，调用者已置 p->vmbusy
+static int
+do_fault(struct proc *p, uint64 va, int write)
 {
   uint64 a = PGROUNDDOWN(va);
-  char *mem = kalloc();
-  if(mem == 0)
+
+  if(a >= MAXUVA)
     return -1;
 
-  memset(mem, 0, PGSIZE);
-  uint64 pa = (uint64)mem;
+  // 0) 页在交换区：读回来，权限位原样恢复
+  pte_t *pte = walk(p->pagetable, a, 0);
+  if(pte != 0 && PTE_SWAPPED(*pte))
+    return swap_in(p, a, pte);
+
+  // 页在内存、权限也允许，只是 PTE_A/PTE_D 未置位：硬件不自动维护
+  // 这两位时（回收会清掉 PTE_A），由这里补上后重试
+  if(pte != 0 && (*pte & (PTE_V | PTE_U)) == (PTE_V | PTE_U) &&
+     (*pte & (write ? PTE_W : PTE_R | PTE_X))){
+    pte_t ad = PTE_A | (write ? PTE_D : 0);
+    if((*pte & ad) != ad){
+      *pte |= ad;
+      sfence_vma_range(p, a, 1);
+      return 0;
+    }
+  }
 
-  // 1) 映射到用户页表：带 PTE_U
-  if(mappages(pagetable, a, PGSIZE, pa, PTE_R|PTE_W|PTE_U) < 0){
-    kfree(mem);
-    return -1;
+  // 1) COW 优先：只有写访问需要 COW 修复
+  if(write && is_cow_page(p->pagetable, a))
+    return cow_alloc(p->pagetable, a);
+
+  // 2) VMA：mmap 区域以及 exec 登记的程序段
+  struct vma *vma = vma_lookup(&p->vma_manager, a);
+  if(vma != 0) {
+    int perm = vma_perm(vma);
+    int advice = vma->advice;
+
+    // PROT_NONE：没有 R/W/X 的 PTE 会被当成下一级页表
+    if((perm & (PTE_R | PTE_W | PTE_X)) == 0)
+      return -1;
+
+    uint64 lo = vma->addr, hi = vma->addr + vma->length;
+    // 对齐的 2 MiB 块整块用 megapage，失败再退回 4K
+    if(vma->f == 0 && (vma->flags & MAP_HUGETLB) &&
+       fault_megapage(p, a, lo, hi, perm) == 0)
+      return 0;
+    // MAP_NORESERVE 的匿名区域稀疏使用，写缺页不替邻页分配内存；
+    // 显式的 madvise() 提示优先
+    if(vma->f == 0 && (vma->flags & MAP_NORESERVE) && write &&
+       advice == MADV_NORMAL)
+      advice = MADV_RANDOM;
+    return fault_around(p, a, lo, hi, perm, write, vma->f ? vma : 0,
+                        advice);
   }
 
-  // 2) 映射到该进程的内核页表：通常不要 PTE_U（避免依赖 SUM）
-  if(mappages(kpagetable, a, PGSIZE, pa, PTE_R|PTE_W) < 0){
-    // 回滚 user 映射（不要在 uvmunmap 里 free，避免双重释放）
-    uvmunmap(pagetable, a, 1, 0);
-    kfree(mem);
+  // 3) lazy allocation：只允许补"已通过 sbrk 扩过的范围"
+  if(a >= p->sz)
     return -1;
-  }
 
-  sfence_vma();
-  return 0;
+  // 相邻页不能越过 p->sz，也不能落进别的 VMA
+  uint64 lo = 0, hi = p->sz < MAXUVA ? p->sz : MAXUVA;
+  vma_hole(&p->vma_manager, a, &lo, &hi);
+  return fault_around(p, a, lo, hi, PTE_R|PTE_W|PTE_U, write, 0,
+                      p->heap_advice);
 }
 
-// initialize kernel pagetable for each process.
-pagetable_t
-proc_kpagetable()
+// 处理当前进程 p 在用户地址 va 上的一次缺页，write 表示写访问。
+// usertrap() 和内核访问用户内存前的预缺页共用这一套逻辑。
+// 处理过程中读到的 PTE 和物理页在睡眠或被抢占后仍要用到，
+// 其间换出和 KSM 不能改写 p 的页表。
+// 成功返回 0；访问非法或内存不足返回 -1。
+int
+uvmfault(struct proc *p, uint64 va, int write)
 {
-  pagetable_t kpt = (pagetable_t) kalloc();
-  if (kpt == NULL)
-    return NULL;
-  memmove(kpt, kernel_pagetable, PGSIZE);
-
-  // remap stack and trampoline, because they share the same page table of level 1 and 0
-  char *pstack = kalloc();
-  if(pstack == NULL)
-    goto fail;
-  if (mappages(kpt, VKSTACK, PGSIZE, (uint64)pstack, PTE_R | PTE_W) != 0)
-    goto fail;
-  
-  return kpt;
+  int r;
 
-fail:
-  kvmfree(kpt, 1);
-  return NULL;
+  p->vmbusy++;
+  r = do_fault(p, va, write);
+  p->vmbusy--;
+  return r;
 }
 
-// only free page table, not physical pages
-void
-kfreewalk(pagetable_t kpt)
-{
-  for (int i = 0; i < 512; i++) {
-    pte_t pte = kpt[i];
-    if ((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0) {
-      kfreewalk((pagetable_t) PTE2PA(pte));
-      kpt[i] = 0;
-    } else if (pte & PTE_V) {
+// 为 fault_around() 准备映射到 va 的物理页：zero 时返回共享的
+// zero_page（已加引用），否则分配清零的新页，文件映射再从文件读入。
+// shared 时直接用页缓存中与其他进程共享的副本：私有文件映射的只读页，
+// 或者 MAP_SHARED 映射的页。完全落在 filesz 之后的页不属于文件，只读时
+// 用 zero_page，可写时分配私有的新页。
+// 返回的页映射失败时直接 kfree() 即可。
+static char *
+fault_page(struct vma *fv, uint64 va, int zero, int shared)
+{
+  char *mem;
+
+  if(fv && shared && PGROUNDDOWN(va) - fv->addr >= fv->filesz){
+    if(fv->prot & PROT_WRITE)
+      shared = 0;
+    else
+      zero = 1;
+  }
+  if(zero){
+    incref(zero_page);
+    return (char*)zero_page;
+  }
+  if(fv && shared)
+    return (char*)vma_cachedpage(fv, va);
+  if((mem = kalloc_zeroed()) == 0)
+    return 0;
+  if(fv && vma_readpage(fv, va, mem) < 0){
+    kfree(mem);
+    return 0;
+  }
+  return mem;
+}
+
+// fault_around() 和 uvmpopulate() 映射新页时使用的权限，
+// 并在 *shared 中返回页面是否取自页缓存（见 fault_page()）。
+static int
+fault_perm(int perm, int write, struct vma *fv, int zero, int *shared)
+{
+  if(zero && (perm & (PTE_W | PTE_COW)))
+    perm = (perm | PTE_COW) & ~PTE_W;
+  else if(write && (perm & PTE_COW))
+    perm = (perm | PTE_W) & ~PTE_COW;   // 新分配的页本来就是私有的
+  // 私有文件映射的只读页可以与其他进程共用页缓存中的副本，
+  // 共享文件映射的页总是取自页缓存，所有映射者写的是同一页
+  *shared = fv && ((fv->flags & MAP_SHARED) || (perm & PTE_W) == 0);
+  return perm;
+}
+
+// 缺页时一次映射 va 所在页以及同一窗口内尚未映射的相邻页。
+// 窗口大小为 p->fault_around 页并按自身大小对齐，再裁剪到
+// [lo, hi)，这样顺序扫描每个窗口只会 fault 一次。
+// advice 是区域的 madvise 提示：MADV_RANDOM 只映射 va 一页，
+// MADV_SEQUENTIAL 从 va 起向后映射 FAULT_AROUND_MAX 页（文件映射即预读）。
+// 匿名内存的读缺页（write == 0）不分配内存，整个窗口都映射到只读的
+// zero_page；可写区域同时打上 PTE_COW，第一次写时再由 cow_alloc() 分配。
+// fv 非空时页面内容从这个文件映射读入，私有映射的只读页取自共享的页缓存。
+// va 映射成功返回 0；相邻页尽力而为，内存不足时直接停下。
+int
+fault_around(struct proc *p, uint64 va, uint64 lo, uint64 hi, int perm,
+             int write, struct vma *fv, int advice)
+{
+  uint64 a = PGROUNDDOWN(va);
+  uint64 n = p->fault_around > 0 ? p->fault_around : 1;
+  uint64 start, end;
+  uint64 saved = 0;
+  int zero = !write && fv == 0;
+  int shared;
+  pte_t *pte;
+  char *mem;
+
+  if(advice == MADV_RANDOM)
+    n = 1;
+  if(advice == MADV_SEQUENTIAL){
+    start = a;
+    end = a + FAULT_AROUND_MAX * PGSIZE;
+  } else {
+    start = a - ((a / PGSIZE) % n) * PGSIZE;
+    end = start + n * PGSIZE;
+  }
+
+  lo = PGROUNDDOWN(lo);
+  hi = PGROUNDUP(hi);
+  if(start < lo)
+    start = lo;
+  if(end > hi)
+    end = hi;
+
+  perm = fault_perm(perm, write, fv, zero, &shared);
+
+  // 已经映射的页再 fault 说明是权限错误，不是缺页
+  pte = walk(p->pagetable, a, 0);
+  if(pte != 0 && (*pte & PTE_V))
+    return -1;
+  if((mem = fault_page(fv, a, zero, shared)) == 0)
+    return -1;
+  // 新映射的页带上 PTE_A（写时还有 PTE_D），回收的时钟扫描不会
+  // 把刚缺页进来的页当成冷页立即换出
+  if(mappages(p->pagetable, a, PGSIZE, (uint64)mem,
+              perm | PTE_A | (write ? PTE_D : 0)) < 0){
+    kfree(mem);
+    return -1;
+  }
+  p->nfault++;
+
+  for(va = start; va < end; va += PGSIZE){
+    if(va == a)
+      continue;
+    pte = walk(p->pagetable, va, 0);
+    if(pte != 0 && (*pte & (PTE_V | PTE_SWAP)))
+      continue;                 // 已映射或在交换区
+    if((mem = fault_page(fv, va, zero, shared)) == 0)
+      break;
+    if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm | PTE_A) < 0){
+      kfree(mem);
       break;
     }
+    saved++;
   }
-  kfree((void *) kpt);
+  p->nfault_saved += saved;
+
+  if(saved == 0)
+    sfence_vma_range(p, a, 1);
+  else
+    sfence_vma_range(p, start, (end - start) / PGSIZE);
+  return 0;
 }
 
-void
-kvmfreeusr(pagetable_t kpt)
-{
-  pte_t pte;
-  for (int i = 0; i < PX(2, MAXUVA); i++) {
-    pte = kpt[i];
-    if ((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0) {
-      kfreewalk((pagetable_t) PTE2PA(pte));
-      kpt[i] = 0;
+// MAP_POPULATE：在 mmap() 返回之前映射 VMA v 的全部页面，文件映射同时
+// 读入，之后访问不再缺页。可写的私有映射直接分配私有页，免去第一次写的
+// COW；其余页面与读缺页得到的相同。新页走每个 hart 的页缓存，它从伙伴
+// 系统成批补充；全部映射完之后只刷新一次 TLB。
+// 内存不足时停在已映射的部分，返回 -1，剩下的页照常按需缺页。
+int
+uvmpopulate(struct proc *p, struct vma *v)
+{
+  uint64 a, lo = v->addr, hi = v->addr + v->length;
+  int perm = vma_perm(v), r = 0;
+  int write = (v->prot & PROT_WRITE) && (v->flags & MAP_PRIVATE);
+  struct vma *fv = v->f ? v : 0;
+  int zero = !write && fv == 0;
+  int shared, fperm;
+  pte_t *pte;
+  char *mem;
+
+  if((perm & (PTE_R | PTE_W | PTE_X)) == 0)
+    return 0;                   // PROT_NONE：没有可以映射的页
+  fperm = fault_perm(perm, write, fv, zero, &shared);
+
+  p->vmbusy++;
+  for(a = lo; a < hi; a += PGSIZE){
+    if(fv == 0 && (v->flags & MAP_HUGETLB) && a % MEGAPGSIZE == 0 &&
+       fault_megapage(p, a, lo, hi, perm) == 0){
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    pte = walk(p->pagetable, a, 0);
+    if(pte != 0 && (*pte & (PTE_V | PTE_SWAP)))
+      continue;
+    if((mem = fault_page(fv, a, zero, shared)) == 0){
+      r = -1;
+      break;
+    }
+    if(mappages(p->pagetable, a, PGSIZE, (uint64)mem, fperm | PTE_A) < 0){
+      kfree(mem);
+      r = -1;
+      break;
     }
   }
+  sfence_vma_range(p, lo, (a - lo) / PGSIZE);
+  p->vmbusy--;
+  return r;
 }
 
-void
-kvmfree(pagetable_t kpt, int stack_free)
+// MAP_HUGETLB 的匿名 VMA [lo, hi) 中缺页：若 va 所在的 2 MiB 块完整
+// 落在区间内且还没有任何 4K 映射，就分配一整块连续内存，用一个
+// megapage 叶子 PTE 映射。成功返回 0；返回 -1 时调用者退回 fault_around()。
+int
+fault_megapage(struct proc *p, uint64 va, uint64 lo, uint64 hi, int perm)
 {
-  if (stack_free) {
-    vmunmap(kpt, VKSTACK, 1, 1);
-    pte_t pte = kpt[PX(2, VKSTACK)];
-    if ((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0) {
-      kfreewalk((pagetable_t) PTE2PA(pte));
-    }
+  uint64 a = MEGAPGROUNDDOWN(va);
+  char *mem;
+
+  if(a < lo || a + MEGAPGSIZE > hi)
+    return -1;
+  // 已经有 level-0 页表（部分页已按 4K 映射）时不再尝试
+  if(walk(p->pagetable, a, 0) != 0)
+    return -1;
+  if((mem = kalloc_pages(MEGAPGORDER)) == 0)
+    return -1;
+  memset(mem, 0, MEGAPGSIZE);
+  // 整块都是新分配的私有内存，MAP_PRIVATE 也不需要 COW
+  if(perm & PTE_COW)
+    perm = (perm | PTE_W) & ~PTE_COW;
+  if(mapmegapage(p->pagetable, a, (uint64)mem, perm) < 0){
+    kfree_pages(mem, MEGAPGORDER);
+    return -1;
   }
-  kvmfreeusr(kpt);
-  kfree(kpt);
+  p->nfault++;
+  p->nfault_saved += (MEGAPGSIZE / PGSIZE) - 1;
+  sfence_vma_range(p, va, 1);
+  return 0;
 }
 
 void vmprint(pagetable_t pagetable)
@@ -810,7 +1405,10 @@ void vmprint(pagetable_t pagetable)
         if (*pte2 & PTE_V)
         {
           pagetable_t pt3 = (pagetable_t) PTE2PA(*pte2);
-          printf(".. ..%d: pte %p pa %p\n", pte2 - pt2, *pte2, pt3);
+          printf(".. ..%d: pte %p pa %p%s\n", pte2 - pt2, *pte2, pt3,
+                 PTE_LEAF(*pte2) ? " (2M)" : "");
+          if (PTE_LEAF(*pte2))
+            continue;
 
           for (pte_t *pte3 = (pte_t *) pt3; pte3 < pt3 + capacity; pte3++)
             if (*pte3 & PTE_V)
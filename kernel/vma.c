@@ -12,81 +12,293 @@
 #include "include/memlayout.h"
 #include "include/spinlock.h"
 #include "include/proc.h"
+#include "include/vm.h"
 #include "include/vma.h"
 #include "include/file.h"
+#include "include/slab.h"
+#include "include/string.h"
+#include "include/fat32.h"
+#include "include/pagecache.h"
+#include "include/asid.h"
 
 extern struct proc *myproc(void);
 
+static struct kmem_cache *vma_cache;
+
+/**
+ * @brief 创建 VMA 节点的 slab 缓存，系统启动时调用一次
+ */
+void vmainit(void) {
+    vma_cache = kmem_cache_create("vma", sizeof(struct vma), 0);
+}
+
 /**
  * @brief 初始化 VMA 管理器
  */
 void vma_init(struct vma_manager *vmam) {
     initlock(&vmam->lock, "vma");
+    vmam->head = 0;
+    vmam->root = 0;
+    vmam->cache = 0;
     vmam->count = 0;
-    for (int i = 0; i < MAX_VMA; i++) {
-        vmam->vmas[i].used = 0;
-        vmam->vmas[i].f = 0;
+}
+
+/*
+ * AVL 树。VMA 互不重叠，起始地址就是唯一的键；每个节点另外记录
+ * 子树中最大的空洞 maxgap，vma_find_free_range() 据此只走一条路径。
+ * 以下函数的调用者都持有 vmam->lock。
+ */
+
+static inline int tree_height(struct vma *n) {
+    return n ? n->height : 0;
+}
+
+static inline uint64 tree_maxgap(struct vma *n) {
+    return n ? n->maxgap : 0;
+}
+
+/**
+ * @brief 由子节点重新计算 n 的高度和 maxgap
+ */
+static void tree_pull(struct vma *n) {
+    int hl = tree_height(n->left), hr = tree_height(n->right);
+    uint64 gl = tree_maxgap(n->left), gr = tree_maxgap(n->right);
+
+    n->height = 1 + (hl > hr ? hl : hr);
+    n->maxgap = n->gap;
+    if (gl > n->maxgap)
+        n->maxgap = gl;
+    if (gr > n->maxgap)
+        n->maxgap = gr;
+}
+
+static struct vma *tree_rotate_right(struct vma *n) {
+    struct vma *l = n->left;
+
+    n->left = l->right;
+    l->right = n;
+    tree_pull(n);
+    tree_pull(l);
+    return l;
+}
+
+static struct vma *tree_rotate_left(struct vma *n) {
+    struct vma *r = n->right;
+
+    n->right = r->left;
+    r->left = n;
+    tree_pull(n);
+    tree_pull(r);
+    return r;
+}
+
+/**
+ * @brief 子树 n 的左右高度差超过 1 时旋转，返回新的子树根
+ */
+static struct vma *tree_balance(struct vma *n) {
+    int bf;
+
+    tree_pull(n);
+    bf = tree_height(n->left) - tree_height(n->right);
+    if (bf > 1) {
+        if (tree_height(n->left->left) < tree_height(n->left->right))
+            n->left = tree_rotate_left(n->left);
+        return tree_rotate_right(n);
     }
+    if (bf < -1) {
+        if (tree_height(n->right->right) < tree_height(n->right->left))
+            n->right = tree_rotate_right(n->right);
+        return tree_rotate_left(n);
+    }
+    return n;
+}
+
+static struct vma *tree_insert(struct vma *n, struct vma *v) {
+    if (n == 0) {
+        v->left = v->right = 0;
+        tree_pull(v);
+        return v;
+    }
+    if (v->addr < n->addr)
+        n->left = tree_insert(n->left, v);
+    else
+        n->right = tree_insert(n->right, v);
+    return tree_balance(n);
 }
 
 /**
- * @brief 分配一个新的 VMA
- * @return 成功返回 VMA 指针，失败返回 NULL
+ * @brief 从子树 n 中摘下最左的节点放入 *min，返回新的子树根
  */
-struct vma* vma_alloc(struct vma_manager *vmam) {
-    struct vma *vma = 0;
+static struct vma *tree_remove_min(struct vma *n, struct vma **min) {
+    if (n->left == 0) {
+        *min = n;
+        return n->right;
+    }
+    n->left = tree_remove_min(n->left, min);
+    return tree_balance(n);
+}
 
-    acquire(&vmam->lock);
+static struct vma *tree_remove(struct vma *n, struct vma *v) {
+    struct vma *m;
+
+    if (v->addr < n->addr) {
+        n->left = tree_remove(n->left, v);
+    } else if (v->addr > n->addr) {
+        n->right = tree_remove(n->right, v);
+    } else {
+        if (n->left == 0)
+            return n->right;
+        if (n->right == 0)
+            return n->left;
+        n->right = tree_remove_min(n->right, &m);
+        m->left = n->left;
+        m->right = n->right;
+        n = m;
+    }
+    return tree_balance(n);
+}
 
-    for (int i = 0; i < MAX_VMA; i++) {
-        if (!vmam->vmas[i].used) {
-            vma = &vmam->vmas[i];
-            vma->used = 1;
-            vmam->count++;
-            break;
+/**
+ * @brief v 的 gap 改变后，更新从根到 v 路径上的 maxgap
+ */
+static void tree_update(struct vma *n, struct vma *v) {
+    if (n == 0)
+        return;
+    if (v->addr < n->addr)
+        tree_update(n->left, v);
+    else if (v->addr > n->addr)
+        tree_update(n->right, v);
+    tree_pull(n);
+}
+
+/**
+ * @brief 在子树 n 中找 gap 不小于 length、地址最高的 VMA
+ */
+static struct vma *tree_fit(struct vma *n, uint64 length) {
+    struct vma *v;
+
+    if (n == 0 || n->maxgap < length)
+        return 0;
+    if ((v = tree_fit(n->right, length)) != 0)
+        return v;
+    if (n->gap >= length)
+        return n;
+    return tree_fit(n->left, length);
+}
+
+/**
+ * @brief 重新计算 v 与上一个 VMA 之间的空洞；0 号页不参与分配
+ */
+static void vma_setgap(struct vma *v) {
+    uint64 base = v->prev ? v->prev->addr + v->prev->length : PGSIZE;
+
+    v->gap = v->addr > base ? v->addr - base : 0;
+}
+
+/**
+ * @brief 地址最高的 VMA
+ * @note 调用者持有 vmam->lock
+ */
+static struct vma *vma_last(struct vma_manager *vmam) {
+    struct vma *n = vmam->root;
+
+    while (n && n->right)
+        n = n->right;
+    return n;
+}
+
+/**
+ * @brief 第一个结束地址大于 addr 的 VMA：包含 addr 的 VMA，或者 addr 之后的第一个
+ * @note 调用者持有 vmam->lock
+ */
+static struct vma *vma_find(struct vma_manager *vmam, uint64 addr) {
+    struct vma *n = vmam->root, *v = 0;
+
+    while (n) {
+        if (n->addr + n->length > addr) {
+            v = n;
+            n = n->left;
+        } else {
+            n = n->right;
         }
     }
-
-    release(&vmam->lock);
-    return vma;
+    return v;
 }
 
 /**
- * @brief 释放一个 VMA
- * @note 调用者需确保已关闭关联的文件（如果有）
+ * @brief 把不与任何 VMA 重叠的 v 加入链表和树
+ * @note 调用者持有 vmam->lock
  */
-void vma_free(struct vma_manager *vmam, struct vma *vma) {
-    acquire(&vmam->lock);
+static void vma_link(struct vma_manager *vmam, struct vma *v) {
+    struct vma *next = vma_find(vmam, v->addr);
+
+    v->next = next;
+    v->prev = next ? next->prev : vma_last(vmam);
+    if (v->prev)
+        v->prev->next = v;
+    else
+        vmam->head = v;
+    vma_setgap(v);
+    vmam->root = tree_insert(vmam->root, v);
+    if (next) {
+        next->prev = v;
+        vma_setgap(next);
+        tree_update(vmam->root, next);
+    }
+    vmam->count++;
+}
 
-    if (vma->used) {
-        vma->used = 0;
-        vma->f = 0;
-        vmam->count--;
+/**
+ * @brief 把 v 从链表和树中摘下，节点由调用者释放
+ * @note 调用者持有 vmam->lock
+ */
+static void vma_unlink(struct vma_manager *vmam, struct vma *v) {
+    if (v->prev)
+        v->prev->next = v->next;
+    else
+        vmam->head = v->next;
+    vmam->root = tree_remove(vmam->root, v);
+    if (v->next) {
+        v->next->prev = v->prev;
+        vma_setgap(v->next);
+        tree_update(vmam->root, v->next);
     }
+    if (vmam->cache == v)
+        vmam->cache = 0;
+    vmam->count--;
+}
 
-    release(&vmam->lock);
+/**
+ * @brief 检查 [addr, addr+length) 是否与已有 VMA 重叠
+ * @note 调用者持有 vmam->lock
+ */
+static int vma_overlap(struct vma_manager *vmam, uint64 addr, uint64 length) {
+    struct vma *v = vma_find(vmam, addr);
+
+    return v && v->addr < addr + length;
 }
 
 /**
  * @brief 查找包含指定地址的 VMA
+ *
+ * 先看上一次命中的 VMA，再查树
  * @param addr 要查找的虚拟地址
  * @return 成功返回 VMA 指针，失败返回 NULL
  */
 struct vma* vma_lookup(struct vma_manager *vmam, uint64 addr) {
-    struct vma *vma = 0;
+    struct vma *v;
 
     acquire(&vmam->lock);
-
-    for (int i = 0; i < MAX_VMA; i++) {
-        struct vma *v = &vmam->vmas[i];
-        if (v->used && addr >= v->addr && addr < v->addr + v->length) {
-            vma = v;
-            break;
-        }
+    v = vmam->cache;
+    if (v == 0 || addr < v->addr || addr >= v->addr + v->length) {
+        v = vma_find(vmam, addr);
+        if (v && v->addr > addr)
+            v = 0;
+        if (v)
+            vmam->cache = v;
     }
-
     release(&vmam->lock);
-    return vma;
+    return v;
 }
 
 /**
@@ -94,13 +306,15 @@ struct vma* vma_lookup(struct vma_manager *vmam, uint64 addr) {
  * @param addr 起始虚拟地址
  * @param length 长度
  * @param offset 文件偏移量
+ * @param filesz 从文件读入的字节数，超出部分填零
  * @param prot 保护标志
  * @param flags 映射标志
  * @param f 关联的文件（匿名映射为 NULL）
  * @return 成功返回 0，失败返回 -1
  */
 int vma_insert(struct vma_manager *vmam, uint64 addr, uint64 length,
-               uint64 offset, int prot, int flags, struct file *f) {
+               uint64 offset, uint64 filesz, int prot, int flags,
+               struct file *f) {
     struct vma *vma;
 
     // 检查参数
@@ -112,47 +326,32 @@ int vma_insert(struct vma_manager *vmam, uint64 addr, uint64 length,
     addr = PGROUNDDOWN(addr);
     length = PGROUNDUP(length);
 
-    // 检查是否与现有 VMA 冲突
-    acquire(&vmam->lock);
-
-    for (int i = 0; i < MAX_VMA; i++) {
-        struct vma *v = &vmam->vmas[i];
-        if (v->used) {
-            // 检查地址范围是否重叠
-            uint64 vma_end = v->addr + v->length;
-            uint64 new_end = addr + length;
-            if (!(addr >= vma_end || new_end <= v->addr)) {
-                release(&vmam->lock);
-                return -1;  // 地址重叠
-            }
-        }
-    }
-
-    // 查找空闲 VMA 槽位
-    vma = 0;
-    for (int i = 0; i < MAX_VMA; i++) {
-        if (!vmam->vmas[i].used) {
-            vma = &vmam->vmas[i];
-            vma->used = 1;
-            vmam->count++;
-            break;
-        }
-    }
-
-    release(&vmam->lock);
-
-    if (!vma) {
-        return -1;  // 没有空闲槽位
+    if ((vma = kmem_cache_alloc(vma_cache)) == 0) {
+        return -1;  // 内存不足
     }
 
     // 初始化 VMA
     vma->addr = addr;
     vma->length = length;
     vma->offset = offset;
+    vma->filesz = filesz;
     vma->prot = prot;
     vma->flags = flags;
+    vma->advice = MADV_NORMAL;
     vma->f = f;
 
+    acquire(&vmam->lock);
+
+    // 检查是否与现有 VMA 冲突
+    if (vma_overlap(vmam, addr, length)) {
+        release(&vmam->lock);
+        kmem_cache_free(vma_cache, vma);
+        return -1;  // 地址重叠
+    }
+
+    vma_link(vmam, vma);
+
+    release(&vmam->lock);
     return 0;
 }
 
@@ -164,27 +363,168 @@ int vma_insert(struct vma_manager *vmam, uint64 addr, uint64 length,
  */
 int vma_remove(struct vma_manager *vmam, uint64 addr, uint64 length) {
     int removed = 0;
+    struct vma *v, *next, *dead = 0;
 
     acquire(&vmam->lock);
 
-    for (int i = 0; i < MAX_VMA; i++) {
-        struct vma *v = &vmam->vmas[i];
-        if (v->used) {
-            // 检查是否在指定范围内
-            if (addr <= v->addr && v->addr + v->length <= addr + length) {
-                // 完全包含，移除整个 VMA
-                v->used = 0;
-                v->f = 0;
-                vmam->count--;
-                removed++;
-            }
+    for (v = vma_find(vmam, addr); v && v->addr < addr + length; v = next) {
+        next = v->next;
+        // 检查是否在指定范围内
+        if (addr <= v->addr && v->addr + v->length <= addr + length) {
+            // 完全包含，移除整个 VMA
+            vma_unlink(vmam, v);
+            v->next = dead;
+            dead = v;
+            removed++;
         }
     }
 
     release(&vmam->lock);
+
+    // fileclose 可能睡眠，在锁外关闭文件并释放节点
+    while ((v = dead) != 0) {
+        dead = v->next;
+        if (v->f)
+            fileclose(v->f);
+        kmem_cache_free(vma_cache, v);
+    }
     return removed;
 }
 
+/**
+ * @brief 把 [*lo, *hi) 收缩到 addr 所在的、不属于任何 VMA 的空洞内
+ *
+ * sbrk 堆的 fault-around 用它避免越界映射到相邻的 mmap 区域
+ */
+void vma_hole(struct vma_manager *vmam, uint64 addr, uint64 *lo, uint64 *hi) {
+    struct vma *v, *prev;
+
+    acquire(&vmam->lock);
+    v = vma_find(vmam, addr);
+    if (v && v->addr <= addr) {
+        prev = v;               // addr 在 VMA 内，不是空洞
+        v = v->next;
+    } else {
+        prev = v ? v->prev : vma_last(vmam);
+    }
+    if (prev && prev->addr + prev->length > *lo)
+        *lo = prev->addr + prev->length;
+    if (v && v->addr < *hi)
+        *hi = v->addr;
+    release(&vmam->lock);
+}
+
+/**
+ * @brief 在页对齐的 addr 处把包含它的 VMA 切成两个
+ *
+ * addr 不在任何 VMA 内部（或恰好是某个 VMA 的起点）时什么也不做。
+ * 后半段继承前半段的属性，文件偏移和 filesz 相应后移。
+ * @return 成功返回 0，内存不足返回 -1
+ */
+int vma_split(struct vma_manager *vmam, uint64 addr) {
+    struct vma *v, *nv;
+    uint64 delta;
+
+    if ((nv = kmem_cache_alloc(vma_cache)) == 0)
+        return -1;
+
+    acquire(&vmam->lock);
+    v = vma_find(vmam, addr);
+    if (v == 0 || v->addr >= addr) {
+        release(&vmam->lock);
+        kmem_cache_free(vma_cache, nv);
+        return 0;
+    }
+
+    delta = addr - v->addr;
+    *nv = *v;
+    nv->addr = addr;
+    nv->length = v->length - delta;
+    nv->offset = v->offset + delta;
+    nv->filesz = v->filesz > delta ? v->filesz - delta : 0;
+    if (nv->f)
+        filedup(nv->f);
+    v->length = delta;
+    if (v->filesz > delta)
+        v->filesz = delta;
+    vma_link(vmam, nv);
+    release(&vmam->lock);
+    return 0;
+}
+
+/**
+ * @brief 把 [addr, addr+length) 内的 VMA 的访问模式设为 advice
+ *
+ * 区间边界落在 VMA 中间时先切开，只改变区间内的部分
+ * @return 成功返回 0，内存不足返回 -1
+ */
+int vma_advise(struct vma_manager *vmam, uint64 addr, uint64 length, int advice) {
+    if (vma_split(vmam, addr) < 0 || vma_split(vmam, addr + length) < 0)
+        return -1;
+
+    acquire(&vmam->lock);
+    for (struct vma *v = vma_find(vmam, addr); v && v->addr < addr + length; v = v->next)
+        if (v->addr >= addr)
+            v->advice = advice;
+    release(&vmam->lock);
+    return 0;
+}
+
+/**
+ * @brief 把 [addr, addr+length) 内的 VMA 的保护标志设为 prot
+ *
+ * 与 vma_advise 一样先在区间边界切开；页表由调用者另行改写
+ * @return 成功返回 0，内存不足返回 -1
+ */
+int vma_protect(struct vma_manager *vmam, uint64 addr, uint64 length, int prot) {
+    if (vma_split(vmam, addr) < 0 || vma_split(vmam, addr + length) < 0)
+        return -1;
+
+    acquire(&vmam->lock);
+    for (struct vma *v = vma_find(vmam, addr); v && v->addr < addr + length; v = v->next)
+        if (v->addr >= addr)
+            v->prot = prot;
+    release(&vmam->lock);
+    return 0;
+}
+
+/**
+ * @brief sbrk 把堆收缩到 sz 之后，删除 sz 以上的 MAP_HEAP VMA
+ *
+ * 跨过 sz 的 VMA 原地截短，不需要分配内存，因此不会失败。
+ * 堆重新增长时新的页恢复默认的可读写权限
+ */
+void vma_trimheap(struct vma_manager *vmam, uint64 sz) {
+    struct vma *v, *next, *dead = 0;
+
+    sz = PGROUNDUP(sz);
+
+    acquire(&vmam->lock);
+    v = vma_find(vmam, sz);
+    if (v && (v->flags & MAP_HEAP) && v->addr < sz) {
+        v->length = sz - v->addr;
+        if (v->next) {
+            vma_setgap(v->next);
+            tree_update(vmam->root, v->next);
+        }
+        v = v->next;
+    }
+    for (; v; v = next) {
+        next = v->next;
+        if (v->flags & MAP_HEAP) {
+            vma_unlink(vmam, v);
+            v->next = dead;
+            dead = v;
+        }
+    }
+    release(&vmam->lock);
+
+    while ((v = dead) != 0) {
+        dead = v->next;
+        kmem_cache_free(vma_cache, v);
+    }
+}
+
 /**
  * @brief 查找空闲的虚拟地址范围
  * @param hint_addr 提示地址（0 表示任意位置）
@@ -194,119 +534,257 @@ int vma_remove(struct vma_manager *vmam, uint64 addr, uint64 length) {
  */
 int vma_find_free_range(struct vma_manager *vmam, uint64 hint_addr,
                         uint64 length, uint64 *result) {
-    uint64 addr;
-    int found;
+    uint64 addr, top;
+    struct vma *v;
 
     // 页对齐
     length = PGROUNDUP(length);
+    if (length == 0 || length >= MAXUVA)
+        return -1;
 
     acquire(&vmam->lock);
 
     if (hint_addr != 0) {
         // 检查提示地址是否可用
         addr = PGROUNDDOWN(hint_addr);
-        found = 1;
-
-        for (int i = 0; i < MAX_VMA && found; i++) {
-            struct vma *v = &vmam->vmas[i];
-            if (v->used) {
-                uint64 vma_end = v->addr + v->length;
-                uint64 new_end = addr + length;
-                if (!(addr >= vma_end || new_end <= v->addr)) {
-                    found = 0;  // 地址重叠
-                }
-            }
-        }
-
-        if (found && addr + length < MAXUVA) {
+        if (addr + length < MAXUVA && !vma_overlap(vmam, addr, length)) {
             *result = addr;
             release(&vmam->lock);
             return 0;
         }
     }
 
-    // 在高地址区域查找空闲空间
-    // 从 MAXUVA 向下查找
-    addr = MAXUVA - length;
-    found = 0;
-
-    while (addr >= PGSIZE && !found) {
-        found = 1;
-
-        // 检查是否与现有 VMA 冲突
-        for (int i = 0; i < MAX_VMA && found; i++) {
-            struct vma *v = &vmam->vmas[i];
-            if (v->used) {
-                uint64 vma_end = v->addr + v->length;
-                uint64 new_end = addr + length;
-                if (!(addr >= vma_end || new_end <= v->addr)) {
-                    found = 0;
-                    addr = v->addr - length;
-                    if (addr < PGSIZE) {
-                        break;
-                    }
-                }
-            }
-        }
-
-        if (found && addr >= PGSIZE) {
-            *result = addr;
-            release(&vmam->lock);
-            return 0;
-        }
+    // 取最高的一个可用位置：先看最后一个 VMA 之上，再按 maxgap 在树中找
+    v = vma_last(vmam);
+    top = v && v->addr + v->length > PGSIZE ? v->addr + v->length : PGSIZE;
+    if (MAXUVA >= top + length) {
+        *result = MAXUVA - length;
+    } else if ((v = tree_fit(vmam->root, length)) != 0) {
+        *result = v->addr - length;
+    } else {
+        release(&vmam->lock);
+        return -1;
     }
 
     release(&vmam->lock);
-    return -1;
+    return 0;
 }
 
 /**
  * @brief 复制 VMA 列表（用于 fork）
+ * @return 成功返回 0，内存不足返回 -1
  */
-void vma_copy(struct vma_manager *dst, struct vma_manager *src) {
+int vma_copy(struct vma_manager *dst, struct vma_manager *src) {
+    int ret = 0;
+
     acquire(&src->lock);
     acquire(&dst->lock);
 
-    dst->count = 0;
-
-    for (int i = 0; i < MAX_VMA; i++) {
-        if (src->vmas[i].used) {
-            dst->vmas[i] = src->vmas[i];
-
-            // 增加文件引用计数
-            if (dst->vmas[i].f) {
-                filedup(dst->vmas[i].f);
-            }
+    for (struct vma *v = src->head; v; v = v->next) {
+        struct vma *nv = kmem_cache_alloc(vma_cache);
+        if (nv == 0) {
+            ret = -1;
+            break;
+        }
+        *nv = *v;
 
-            dst->count++;
-        } else {
-            dst->vmas[i].used = 0;
-            dst->vmas[i].f = 0;
+        // 增加文件引用计数
+        if (nv->f) {
+            filedup(nv->f);
         }
+
+        vma_link(dst, nv);
     }
 
     release(&dst->lock);
     release(&src->lock);
+    return ret;
+}
+
+/**
+ * @brief fork 时把 VMA 中已经映射的页复制到子进程的页表 new
+ *
+ * [0, sz) 已由 uvmcopy() 复制，这里只处理 sz 之上的部分（mmap 区域）。
+ * 私有映射（匿名和 MAP_PRIVATE 文件映射）父子以 COW 共享当前内容，
+ * MAP_SHARED 映射共用同一页。失败时撤销 new 中已复制的映射。
+ * @return 成功返回 0，内存不足返回 -1
+ */
+int vma_fork(struct vma_manager *vmam, pagetable_t old, pagetable_t new, uint64 sz) {
+    struct vma *v, *failed = 0;
+    uint64 start;
+
+    sz = PGROUNDUP(sz);
+    acquire(&vmam->lock);
+    for (v = vmam->head; v; v = v->next) {
+        start = v->addr > sz ? v->addr : sz;
+        if (start >= v->addr + v->length)
+            continue;
+        if (uvmcopyrange(old, new, start, v->addr + v->length,
+                         (v->flags & MAP_SHARED) != 0) < 0) {
+            failed = v;
+            break;
+        }
+    }
+    // uvmcopyrange() 已经撤销了失败的那个 VMA，再撤销它之前的
+    for (v = vmam->head; failed && v != failed; v = v->next) {
+        start = v->addr > sz ? v->addr : sz;
+        if (start < v->addr + v->length)
+            uvmunmap(new, start, (v->addr + v->length - start) / PGSIZE, 1);
+    }
+    release(&vmam->lock);
+    return failed ? -1 : 0;
 }
 
 /**
  * @brief 清理所有 VMA（用于 exit）
  */
 void vma_cleanup(struct vma_manager *vmam) {
+    struct vma *v, *dead;
+
     acquire(&vmam->lock);
+    dead = vmam->head;
+    vmam->head = 0;
+    vmam->root = 0;
+    vmam->cache = 0;
+    vmam->count = 0;
+    release(&vmam->lock);
 
-    for (int i = 0; i < MAX_VMA; i++) {
-        if (vmam->vmas[i].used) {
-            // 关闭关联的文件
-            if (vmam->vmas[i].f) {
-                fileclose(vmam->vmas[i].f);
-                vmam->vmas[i].f = 0;
-            }
-            vmam->vmas[i].used = 0;
+    while ((v = dead) != 0) {
+        dead = v->next;
+        // 关闭关联的文件
+        if (v->f) {
+            fileclose(v->f);
         }
+        kmem_cache_free(vma_cache, v);
     }
+}
 
-    vmam->count = 0;
+/**
+ * @brief 把 MAP_SHARED 文件映射 v 在 [start, end) 内的脏页写回文件
+ *
+ * 脏页由 PTE_D 判断。写之前先清掉 PTE_D，p 非空时同时刷新这一页的 TLB，
+ * 这样写回期间再次写入的页会重新变脏。超出文件末尾的部分不写。可能睡眠。
+ * @return 成功返回 0，写文件出错返回 -1
+ */
+int vma_writeback(struct proc *p, pagetable_t pagetable, struct vma *v,
+                  uint64 start, uint64 end) {
+    struct dirent *ep;
+    int r = 0;
+
+    if (!(v->flags & MAP_SHARED) || v->f == 0 || v->f->type != FD_ENTRY)
+        return 0;
+    ep = v->f->ep;
+    if (start < v->addr)
+        start = v->addr;
+    if (end > v->addr + v->length)
+        end = v->addr + v->length;
+
+    for (uint64 a = PGROUNDDOWN(start); a < end; a += PGSIZE) {
+        pte_t *pte = walk(pagetable, a, 0);
+        if (pte == 0 || (*pte & (PTE_V | PTE_D)) != (PTE_V | PTE_D))
+            continue;
+        *pte &= ~PTE_D;
+        if (p)
+            sfence_vma_range(p, a, 1);
+
+        uint64 off = a - v->addr;
+        if (off >= v->filesz)
+            continue;
+        uint n = v->filesz - off < PGSIZE ? v->filesz - off : PGSIZE;
+        uint foff = v->offset + off;
+        elock(ep);
+        if (foff < ep->file_size) {
+            if (n > ep->file_size - foff)
+                n = ep->file_size - foff;
+            if (ewriteback(ep, PTE2PA(*pte), foff, n) != n)
+                r = -1;
+        }
+        eunlock(ep);
+    }
+    return r;
+}
 
+/**
+ * @brief 解除所有 VMA 在 pagetable 中的映射并释放页面（用于 exit/exec）
+ *
+ * 共享文件映射的脏页先写回文件。
+ * 页面通过引用计数释放，仍被其他进程共享的页面不会真正归还
+ */
+void vma_unmapall(struct vma_manager *vmam, pagetable_t pagetable) {
+    // 写文件会睡眠，不能持有 vmam->lock；VMA 链表只由所属进程
+    // 修改，而这里正是它自己在 exit/exec，可以不加锁遍历
+    for (struct vma *v = vmam->head; v; v = v->next)
+        vma_writeback(0, pagetable, v, v->addr, v->addr + v->length);
+
+    acquire(&vmam->lock);
+    for (struct vma *v = vmam->head; v; v = v->next)
+        uvmunmap(pagetable, v->addr, v->length / PGSIZE, 1);
     release(&vmam->lock);
 }
+
+/**
+ * @brief 把 src 的全部 VMA 转移给空的 dst（exec 安装新映像时使用）
+ */
+void vma_move(struct vma_manager *dst, struct vma_manager *src) {
+    acquire(&src->lock);
+    acquire(&dst->lock);
+    if (dst->head)
+        panic("vma_move");
+    dst->head = src->head;
+    dst->root = src->root;
+    dst->cache = 0;
+    dst->count = src->count;
+    src->head = 0;
+    src->root = 0;
+    src->cache = 0;
+    src->count = 0;
+    release(&dst->lock);
+    release(&src->lock);
+}
+
+/**
+ * @brief 从文件映射 vma 读入 va 所在的页到 mem
+ *
+ * mem 必须已经清零；超出 filesz 的部分保持为 0。可能睡眠。
+ * @return 成功返回 0，失败返回 -1
+ */
+int vma_readpage(struct vma *vma, uint64 va, char *mem) {
+    uint64 off = PGROUNDDOWN(va) - vma->addr;
+    uint n;
+    int r;
+
+    if (vma->f == 0 || vma->f->type != FD_ENTRY)
+        return -1;
+    if (off >= vma->filesz)
+        return 0;
+    n = vma->filesz - off < PGSIZE ? vma->filesz - off : PGSIZE;
+
+    // read(fd, buf) 可能在持有同一文件锁时对映射自该文件的 buf 缺页，
+    // 例如 cat 读自己的可执行文件，这时不能再加锁
+    int locked = holdingsleep(&vma->f->ep->lock);
+    if (!locked)
+        elock(vma->f->ep);
+    r = eread(vma->f->ep, 0, (uint64)mem, vma->offset + off, n);
+    if (!locked)
+        eunlock(vma->f->ep);
+    return r < 0 ? -1 : 0;
+}
+
+/**
+ * @brief 从页缓存取得文件映射 vma 中 va 所在页的共享副本
+ *
+ * 返回的页已加引用，和同一文件的其他映射共用。私有映射只能以只读或
+ * COW 方式映射它，MAP_SHARED 映射直接可写，脏页由 vma_writeback() 写回。
+ * 调用者保证该页至少有一个字节来自文件。可能睡眠。
+ * @return 成功返回物理地址，失败返回 0
+ */
+uint64 vma_cachedpage(struct vma *vma, uint64 va) {
+    uint64 off = PGROUNDDOWN(va) - vma->addr;
+    uint n;
+
+    if (vma->f == 0 || vma->f->type != FD_ENTRY || off >= vma->filesz)
+        return 0;
+    n = vma->filesz - off < PGSIZE ? vma->filesz - off : PGSIZE;
+    return pcache_get(vma->f->ep, vma->offset + off, n,
+                      (vma->flags & MAP_SHARED) != 0);
+}
@@ -0,0 +1,241 @@
+// Compressed in-memory store for swapped-out pages.
+//
+// swap.c offers every page it evicts here first. A page whose 64-bit
+// words are all equal is kept as just that word; otherwise it is
+// compressed with a small LZ77 coder in the spirit of LZ4 and, if
+// that at least halves it, copied into an object of the smallest
+// fitting slab size class. Pages that do not compress go to the
+// swap file instead. The store is capped at ZRAM_PAGES pages of
+// memory, counted by object size.
+//
+// Compressed format: a sequence of
+//   token   high nibble: literal count, low nibble: match length - 4,
+//           15 means more length bytes follow, each added, until
+//           one is below 255
+//   literals
+//   offset  2 bytes, little endian, back from the current position
+//   match length bytes, if any
+// The last sequence has no offset: it ends once the page is full.
+
+#include "include/types.h"
+#include "include/param.h"
+#include "include/riscv.h"
+#include "include/spinlock.h"
+#include "include/slab.h"
+#include "include/string.h"
+#include "include/printf.h"
+#include "include/zram.h"
+
+#define MINMATCH  4
+#define HASHBITS  10
+
+// object sizes that pack 32, 16, 10, 6, 4, 3 and 2 objects into a slab
+static const ushort zclass[] = { 112, 240, 392, 664, 1000, 1344, 2016 };
+static char *zname[] = {
+  "zram112", "zram240", "zram392", "zram664", "zram1000", "zram1344", "zram2016",
+};
+#define NZCLASS   (sizeof(zclass) / sizeof(zclass[0]))
+#define ZMAXLEN   2016
+
+static struct {
+  struct spinlock lock;         // protects the scratch space and counters
+  struct kmem_cache *cache[NZCLASS];
+  ushort table[1 << HASHBITS];  // last position of each 4-byte hash
+  uchar buf[ZMAXLEN];
+  uint64 npages;                // pages stored
+  uint64 bytes;                 // memory used by their objects
+  uint64 same;                  // pages stored as a fill word
+} zram;
+
+void
+zraminit(void)
+{
+  initlock(&zram.lock, "zram");
+  for(int i = 0; i < NZCLASS; i++)
+    zram.cache[i] = kmem_cache_create(zname[i], zclass[i], 0);
+}
+
+static inline uint
+read32(const uchar *p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+// Append the extra length bytes for a length field of n >= 15.
+static int
+putlen(uchar *dst, int op, int n)
+{
+  for(n -= 15; n >= 255; n -= 255){
+    if(op >= ZMAXLEN)
+      return -1;
+    dst[op++] = 255;
+  }
+  if(op >= ZMAXLEN)
+    return -1;
+  dst[op++] = n;
+  return op;
+}
+
+// Append one sequence; mlen == 0 for the last one.
+// Returns the new output length, -1 if it would exceed ZMAXLEN.
+static int
+emit(uchar *dst, int op, const uchar *lit, int nlit, int off, int mlen)
+{
+  int m = mlen ? mlen - MINMATCH : 0;
+
+  if(op >= ZMAXLEN)
+    return -1;
+  dst[op++] = (nlit < 15 ? nlit : 15) << 4 | (m < 15 ? m : 15);
+  if(nlit >= 15 && (op = putlen(dst, op, nlit)) < 0)
+    return -1;
+  if(op + nlit > ZMAXLEN)
+    return -1;
+  memmove(dst + op, lit, nlit);
+  op += nlit;
+  if(mlen == 0)
+    return op;
+  if(op + 2 > ZMAXLEN)
+    return -1;
+  dst[op++] = off;
+  dst[op++] = off >> 8;
+  if(m >= 15 && (op = putlen(dst, op, m)) < 0)
+    return -1;
+  return op;
+}
+
+// Compress one page into zram.buf. Returns the compressed length,
+// or 0 if it does not fit in ZMAXLEN. Caller holds zram.lock.
+static int
+compress(const uchar *src)
+{
+  int ip = 0, anchor = 0, op = 0;
+
+  memset(zram.table, 0xff, sizeof(zram.table));
+  while(ip + MINMATCH <= PGSIZE){
+    uint seq = read32(src + ip);
+    int h = (seq * 2654435761u) >> (32 - HASHBITS);
+    int ref = zram.table[h];
+    zram.table[h] = ip;
+    if(ref == 0xffff || read32(src + ref) != seq){
+      ip++;
+      continue;
+    }
+    int len = MINMATCH;
+    while(ip + len < PGSIZE && src[ref + len] == src[ip + len])
+      len++;
+    if((op = emit(zram.buf, op, src + anchor, ip - anchor, ip - ref, len)) < 0)
+      return 0;
+    ip += len;
+    anchor = ip;
+  }
+  if((op = emit(zram.buf, op, src + anchor, PGSIZE - anchor, 0, 0)) < 0)
+    return 0;
+  return op;
+}
+
+static void
+decompress(const uchar *src, int len, uchar *dst)
+{
+  int ip = 0, op = 0, n, b;
+
+  while(ip < len){
+    int t = src[ip++];
+    if((n = t >> 4) == 15)
+      do { n += (b = src[ip++]); } while(b == 255);
+    memmove(dst + op, src + ip, n);
+    ip += n;
+    op += n;
+    if(op >= PGSIZE)
+      break;
+    int off = src[ip] | src[ip + 1] << 8;
+    ip += 2;
+    if((n = t & 15) == 15)
+      do { n += (b = src[ip++]); } while(b == 255);
+    for(n += MINMATCH; n > 0; n--, op++)
+      dst[op] = dst[op - off];
+  }
+  if(op != PGSIZE)
+    panic("zram: corrupt page");
+}
+
+// Try to keep a compressed copy of page in zp.
+// Returns 0 on success, -1 if the page does not compress well
+// enough or the store is full.
+int
+zram_store(char *page, struct zpage *zp)
+{
+  uint64 *w = (uint64*)page;
+  int i, len;
+  char *obj;
+
+  for(i = 1; i < PGSIZE / sizeof(uint64); i++)
+    if(w[i] != w[0])
+      break;
+  if(i == PGSIZE / sizeof(uint64)){
+    zp->v = w[0];
+    zp->len = 0;
+    acquire(&zram.lock);
+    zram.npages++;
+    zram.same++;
+    release(&zram.lock);
+    return 0;
+  }
+
+  acquire(&zram.lock);
+  if((len = compress((uchar*)page)) == 0){
+    release(&zram.lock);
+    return -1;
+  }
+  for(i = 0; zclass[i] < len; i++)
+    ;
+  if(zram.bytes + zclass[i] > (uint64)ZRAM_PAGES * PGSIZE ||
+     (obj = kmem_cache_alloc(zram.cache[i])) == 0){
+    release(&zram.lock);
+    return -1;
+  }
+  memmove(obj, zram.buf, len);
+  zram.npages++;
+  zram.bytes += zclass[i];
+  release(&zram.lock);
+
+  zp->v = (uint64)obj;
+  zp->len = len;
+  zp->cls = i;
+  return 0;
+}
+
+// Decompress zp into page. zp stays stored.
+void
+zram_load(struct zpage *zp, char *page)
+{
+  if(zp->len == 0){
+    uint64 *w = (uint64*)page;
+    for(int i = 0; i < PGSIZE / sizeof(uint64); i++)
+      w[i] = zp->v;
+    return;
+  }
+  decompress((uchar*)zp->v, zp->len, (uchar*)page);
+}
+
+void
+zram_free(struct zpage *zp)
+{
+  if(zp->len != 0)
+    kmem_cache_free(zram.cache[zp->cls], (void*)zp->v);
+  acquire(&zram.lock);
+  zram.npages--;
+  if(zp->len == 0)
+    zram.same--;
+  else
+    zram.bytes -= zclass[zp->cls];
+  release(&zram.lock);
+}
+
+// 读取压缩存储的统计信息，不加锁读取，仅供参考
+void
+zram_stat(uint64 *npages, uint64 *bytes, uint64 *same)
+{
+  *npages = zram.npages;
+  *bytes = zram.bytes;
+  *same = zram.same;
+}
@@ -3,6 +3,8 @@
 
 #include "kernel/include/types.h"
 #include "kernel/include/stat.h"
+#include "kernel/include/param.h"
+#include "kernel/include/sysinfo.h"
 #include "xv6-user/user.h"
 
 // 简化的打印函数
@@ -238,6 +240,59 @@ void test_cow_with_exec(void)
   free(data);
 }
 
+// 测试6：子进程退出后，父进程是页面的唯一持有者，写入时应直接复用而不复制
+void test_cow_reuse(void)
+{
+  print("Test 6: COW reuse by the last owner\n");
+
+  int page_size = 4096;
+  int num_pages = 10;
+  struct sysinfo before, after;
+  char *data = (char*)malloc(page_size * num_pages);
+  if (data == 0) {
+    print("  FAIL: malloc failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < page_size * num_pages; i++) {
+    data[i] = 'R';
+  }
+
+  int pid = fork();
+  if (pid == 0) {
+    exit(0);
+  }
+  wait(0);
+
+  if (sysinfo(&before) < 0) {
+    print("  FAIL: sysinfo failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < num_pages; i++) {
+    data[i * page_size] = 'W';
+  }
+  if (sysinfo(&after) < 0) {
+    print("  FAIL: sysinfo failed\n");
+    exit(1);
+  }
+
+  print("  reused: ");
+  printnum(after.cowreuse - before.cowreuse);
+  print(", copied: ");
+  printnum(after.cowcopy - before.cowcopy);
+  print("\n");
+  if (after.cowreuse - before.cowreuse < num_pages) {
+    print("  FAIL: sole owner still copied\n");
+    exit(1);
+  }
+  if (data[0] != 'W' || data[1] != 'R') {
+    print("  FAIL: data wrong after reuse\n");
+    exit(1);
+  }
+  print("  PASS\n");
+
+  free(data);
+}
+
 int
 main(void)
 {
@@ -258,6 +313,9 @@ main(void)
   test_cow_with_exec();
   print("\n");
 
+  test_cow_reuse();
+  print("\n");
+
   print("=== All COW tests passed! ===\n");
   exit(0);
 }
@@ -0,0 +1,103 @@
+// ctxbench - 测量进程切换的开销
+//
+// 父子进程通过两条管道来回传递一个字节（ping-pong），每次传递都会引起
+// 一次进程切换。每个进程在收到字节后还会访问自己工作集中的若干页，
+// 切换时 TLB 被清空的话，这些访问都要重新走一遍页表。
+//
+// 用法: ctxbench [rounds] [pages]
+// 对比 make run 与 make run asid=off 两个内核下的结果即可看到 ASID 的效果。
+
+#include "kernel/include/types.h"
+#include "kernel/include/stat.h"
+#include "xv6-user/user.h"
+
+#define PGSIZE 4096
+
+static void
+touch(char *ws, int pages)
+{
+  for (int i = 0; i < pages; i++)
+    ws[i * PGSIZE]++;
+}
+
+static int
+run(int rounds, int pages)
+{
+  int p2c[2], c2p[2];
+  char b = 0;
+
+  if (pipe(p2c) < 0 || pipe(c2p) < 0) {
+    printf("ctxbench: pipe failed\n");
+    exit(1);
+  }
+
+  // 工作集在 fork 之前分配并写入，fork 后各自写一遍，避免计时中出现缺页和 COW
+  char *ws = sbrk(pages * PGSIZE);
+  if (ws == (char *)-1) {
+    printf("ctxbench: sbrk failed\n");
+    exit(1);
+  }
+  touch(ws, pages);
+
+  int pid = fork();
+  if (pid < 0) {
+    printf("ctxbench: fork failed\n");
+    exit(1);
+  }
+  if (pid == 0) {
+    close(p2c[1]);
+    close(c2p[0]);
+    touch(ws, pages);
+    for (int i = 0; i < rounds; i++) {
+      if (read(p2c[0], &b, 1) != 1)
+        break;
+      touch(ws, pages);
+      write(c2p[1], &b, 1);
+    }
+    exit(0);
+  }
+
+  close(p2c[0]);
+  close(c2p[1]);
+  touch(ws, pages);
+
+  int start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    write(p2c[1], &b, 1);
+    if (read(c2p[0], &b, 1) != 1)
+      break;
+    touch(ws, pages);
+  }
+  int ticks = uptime() - start;
+
+  close(p2c[1]);
+  close(c2p[0]);
+  wait(0);
+  sbrk(-pages * PGSIZE);
+  return ticks;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 2000;
+  int pages = 16;
+
+  if (argc > 1)
+    rounds = atoi(argv[1]);
+  if (argc > 2)
+    pages = atoi(argv[2]);
+  if (rounds <= 0 || pages < 0) {
+    printf("usage: ctxbench [rounds] [pages]\n");
+    exit(1);
+  }
+
+  printf("ctxbench: %d round trips, %d pages touched per switch\n", rounds, pages);
+  for (int n = 0; n <= pages; n = n ? n * 2 : 1) {
+    int t = run(rounds, n);
+    // 每轮往返包含两次切换
+    printf("  pages %d: %d ticks, %d switches/tick\n", n, t,
+           t > 0 ? 2 * rounds / t : 2 * rounds);
+  }
+  exit(0);
+}
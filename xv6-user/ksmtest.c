@@ -0,0 +1,124 @@
+// ksmtest - 几个进程各自持有内容相同的私有页，打开同页合并后
+// 检查这些页被合并，且合并后各自写入互不影响
+
+#include "kernel/include/types.h"
+#include "kernel/include/param.h"
+#include "kernel/include/sysinfo.h"
+#include "xv6-user/user.h"
+
+#define PGSIZE  4096
+#define NPAGES  32
+#define NCHILD  3
+
+static void
+fail(const char *msg)
+{
+  printf("ksmtest FAIL: %s\n", msg);
+  exit(1);
+}
+
+static uint64
+word(int i, int j)
+{
+  return (uint64)i * 1000003 + j;
+}
+
+static void
+fill(char *base)
+{
+  for(int i = 0; i < NPAGES; i++){
+    uint64 *w = (uint64*)(base + (uint64)i * PGSIZE);
+    for(int j = 0; j < PGSIZE / sizeof(uint64); j++)
+      w[j] = word(i, j);
+  }
+}
+
+static void
+check(char *base, const char *what)
+{
+  for(int i = 0; i < NPAGES; i++){
+    uint64 *w = (uint64*)(base + (uint64)i * PGSIZE);
+    for(int j = 0; j < PGSIZE / sizeof(uint64); j++){
+      if(w[j] != word(i, j)){
+        printf("page %d: ", i);
+        fail(what);
+      }
+    }
+  }
+}
+
+int
+main(void)
+{
+  struct sysinfo before, info;
+  int go[2], pids[NCHILD];
+  char c;
+
+  printf("ksmtest starting\n");
+  uint64 brk = (uint64)sbrk(0);
+  if(brk % PGSIZE)
+    sbrk(PGSIZE - brk % PGSIZE);  // 按页对齐，每页内容才完全相同
+  char *base = sbrk(NPAGES * PGSIZE);
+  if(base == (char*)-1)
+    fail("sbrk failed");
+  fill(base);
+  if(pipe(go) < 0)
+    fail("pipe failed");
+
+  // 子进程重写同样的内容：COW 被打破，每个进程各有一份相同的页
+  for(int k = 0; k < NCHILD; k++){
+    if((pids[k] = fork()) < 0)
+      fail("fork failed");
+    if(pids[k] == 0){
+      close(go[1]);
+      fill(base);
+      if(read(go[0], &c, 1) != 1)
+        exit(1);
+      check(base, "child data changed by merging");
+      for(int i = 0; i < NPAGES; i += 2)
+        *(uint64*)(base + (uint64)i * PGSIZE) = ~0ull;
+      for(int i = 1; i < NPAGES; i += 2)
+        if(*(uint64*)(base + (uint64)i * PGSIZE) != word(i, 0))
+          exit(1);
+      exit(0);
+    }
+  }
+  close(go[0]);
+
+  printf("[1] identical pages of %d processes get merged...\n", NCHILD + 1);
+  if(sysinfo(&before) < 0)
+    fail("sysinfo failed");
+  int was = ksm(1);
+  for(int t = 0; ; t++){
+    if(sysinfo(&info) < 0)
+      fail("sysinfo failed");
+    if(info.ksmsaved >= before.ksmsaved + NPAGES * NCHILD)
+      break;
+    if(t >= 600){
+      printf("saved %d after %d passes: ", (int)(info.ksmsaved - before.ksmsaved),
+             (int)(info.ksmpasses - before.ksmpasses));
+      fail("pages were not merged");
+    }
+    sleep(1);
+  }
+  printf("    OK (%d pages saved, %d shared)\n",
+         (int)(info.ksmsaved - before.ksmsaved), (int)info.ksmshared);
+
+  printf("[2] writes to merged pages stay private...\n");
+  check(base, "parent data changed by merging");
+  for(int k = 0; k < NCHILD; k++)
+    if(write(go[1], "x", 1) != 1)
+      fail("pipe write failed");
+  for(int k = 0; k < NCHILD; k++){
+    int st;
+    wait(&st);
+    if(st != 0)
+      fail("child saw wrong data");
+  }
+  check(base, "child writes leaked into parent");
+  printf("    OK\n");
+
+  ksm(was);
+  printf("ksmtest PASS\n");
+  exit(0);
+}
@@ -1,4 +1,8 @@
 #include "kernel/include/types.h"
+#include "kernel/include/param.h"
+#include "kernel/include/procinfo.h"
+#include "kernel/include/sysinfo.h"
+#include "kernel/include/fcntl.h"
 #include "xv6-user/user.h"
 
 #define PGSIZE 4096
@@ -110,15 +114,395 @@ test_negative_sbrk_unmap()
   printf("    OK\n");
 }
 
+static struct procinfo info[NPROC];
+
+// 读取当前进程的缺页计数
+static void
+faults(uint64 *nfault, uint64 *saved)
+{
+  int pid = getpid();
+  int n = getprocs(info, NPROC);
+  for(int i = 0; i < n; i++){
+    if(info[i].pid == pid){
+      *nfault = info[i].nfault;
+      *saved = info[i].nfault_saved;
+      return;
+    }
+  }
+  fail("getprocs did not report this process");
+}
+
+// 顺序写 npages 页，返回期间发生的缺页次数，并检查每页都是 demand-zero
+static uint64
+touch(char *p, int npages, uint64 *saved)
+{
+  uint64 f0, s0, f1, s1;
+
+  faults(&f0, &s0);
+  for(int i = 0; i < npages; i++){
+    if(p[i * PGSIZE] != 0 || p[i * PGSIZE + PGSIZE - 1] != 0)
+      fail("fault-around page not zeroed");
+    p[i * PGSIZE] = i;
+  }
+  faults(&f1, &s1);
+  *saved = s1 - s0;
+  return f1 - f0;
+}
+
+static void
+test_fault_around()
+{
+  printf("[5] fault-around on heap and anonymous mmap...\n");
+
+  int npages = 32;
+  uint64 nf, saved;
+
+  // 窗口为 1：每页一次 fault
+  int old = faultaround(1);
+  if(old <= 0)
+    fail("faultaround query failed");
+  char *p = sbrk(npages * PGSIZE);
+  if(p == (char*)-1)
+    fail("sbrk failed");
+  nf = touch(p, npages, &saved);
+  if(nf != npages || saved != 0)
+    fail("window 1 should fault once per page");
+
+  // 窗口为 8：32 页最多 5 次 fault（起点未必按窗口对齐）
+  if(faultaround(8) != 1)
+    fail("faultaround did not return previous window");
+  p = sbrk(npages * PGSIZE);
+  if(p == (char*)-1)
+    fail("sbrk failed");
+  nf = touch(p, npages, &saved);
+  if(nf < npages / 8 || nf > npages / 8 + 1 || nf + saved != npages)
+    fail("heap fault-around count wrong");
+
+  // 不能越过 sbrk 的边界
+  p = sbrk(PGSIZE);
+  if(p == (char*)-1)
+    fail("sbrk failed");
+  nf = touch(p, 1, &saved);
+  if(nf != 1 || saved != 0)
+    fail("fault-around mapped past p->sz");
+
+  // 匿名 mmap 同样生效
+  char *m = mmap(0, npages * PGSIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(m == (char*)-1)
+    fail("mmap failed");
+  nf = touch(m, npages, &saved);
+  if(nf < npages / 8 || nf > npages / 8 + 1 || nf + saved != npages)
+    fail("mmap fault-around count wrong");
+  munmap(m, npages * PGSIZE);
+
+  faultaround(0);
+  printf("    OK\n");
+}
+
+static void
+test_zero_page()
+{
+  printf("[6] read faults share the zero page...\n");
+
+  int npages = 64;
+  struct sysinfo before, after;
+
+  char *p = sbrk(npages * PGSIZE);
+  if(p == (char*)-1)
+    fail("sbrk failed");
+  if(sysinfo(&before) < 0)
+    fail("sysinfo failed");
+
+  int sum = 0;
+  for(int i = 0; i < npages; i++)
+    sum += p[i * PGSIZE];
+  if(sum != 0)
+    fail("untouched heap not zero");
+
+  if(sysinfo(&after) < 0)
+    fail("sysinfo failed");
+  if(after.zpmapped < before.zpmapped + npages)
+    fail("read faults did not map the zero page");
+  // 只读访问最多只需要几个页表页
+  if(before.freemem > after.freemem + 4 * PGSIZE)
+    fail("read faults allocated private pages");
+
+  // 第一次写才得到私有页，其它页仍然是零
+  p[5 * PGSIZE] = 'x';
+  if(p[5 * PGSIZE] != 'x' || p[4 * PGSIZE] != 0 || p[6 * PGSIZE] != 0)
+    fail("write after zero-page read broken");
+
+  // fork 后子进程写不能影响父进程
+  int pid = fork();
+  if(pid < 0)
+    fail("fork failed");
+  if(pid == 0){
+    p[7 * PGSIZE] = 'c';
+    exit(p[7 * PGSIZE] == 'c' ? 0 : 1);
+  }
+  int st;
+  wait(&st);
+  if(st != 0 || p[7 * PGSIZE] != 0)
+    fail("zero page shared writes across fork");
+
+  printf("    OK\n");
+}
+
+// 已初始化的数据段：exec 不再预先读入，由缺页从可执行文件读出
+#define SEGPAGES 16
+#define SEG(i) [(i) * PGSIZE] = 'a' + (i)
+static char segdata[SEGPAGES * PGSIZE] __attribute__((aligned(PGSIZE))) = {
+  SEG(0), SEG(1), SEG(2), SEG(3), SEG(4), SEG(5), SEG(6), SEG(7),
+  SEG(8), SEG(9), SEG(10), SEG(11), SEG(12), SEG(13), SEG(14), SEG(15),
+};
+
+static void
+test_exec_demand_paging()
+{
+  printf("[7] program data is paged in from the executable...\n");
+
+  uint64 f0, s0, f1, s1;
+
+  // 窗口为 1：每页第一次访问各缺页一次，内容来自文件
+  faultaround(1);
+  faults(&f0, &s0);
+  for(int i = 0; i < SEGPAGES; i++){
+    if(segdata[i * PGSIZE] != 'a' + i || segdata[i * PGSIZE + 1] != 0)
+      fail("data page has wrong contents");
+  }
+  faults(&f1, &s1);
+  if(f1 - f0 != SEGPAGES)
+    fail("data pages were not faulted in one by one");
+
+  // 数据段是私有映射：子进程的写不影响父进程
+  int pid = fork();
+  if(pid < 0)
+    fail("fork failed");
+  if(pid == 0){
+    segdata[3 * PGSIZE] = 'X';
+    exit(segdata[3 * PGSIZE] == 'X' ? 0 : 1);
+  }
+  int st;
+  wait(&st);
+  if(st != 0 || segdata[3 * PGSIZE] != 'd')
+    fail("child write leaked into parent data segment");
+
+  faultaround(0);
+  printf("    OK\n");
+}
+
+static void
+test_shared_text()
+{
+  printf("[8] processes running the same binary share its pages...\n");
+
+  struct sysinfo before, after;
+  char *argv[] = { "lazytest", "-x", 0 };
+
+  // 我们自己的代码页已经在页缓存里，再运行一份同样的程序应该命中
+  if(sysinfo(&before) < 0)
+    fail("sysinfo failed");
+  int pid = spawn("/bin/lazytest", argv, 0, 0);
+  if(pid < 0)
+    fail("spawn failed");
+  int st;
+  if(wait(&st) != pid || st != 0)
+    fail("child failed");
+  if(sysinfo(&after) < 0)
+    fail("sysinfo failed");
+  if(after.pchit <= before.pchit)
+    fail("second instance did not hit the page cache");
+
+  printf("    OK\n");
+}
+
+static void
+test_madvise()
+{
+  printf("[9] madvise hints...\n");
+
+  int npages = 32;
+  uint64 nf, saved, f0, s0, f1, s1;
+  struct sysinfo before, after;
+
+  // RANDOM：每页一次 fault；SEQUENTIAL：一次 fault 映射整个区域
+  char *m = mmap(0, npages * PGSIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(m == (char*)-1)
+    fail("mmap failed");
+  if(madvise(m, npages * PGSIZE, MADV_RANDOM) < 0)
+    fail("madvise(RANDOM) failed");
+  nf = touch(m, npages, &saved);
+  if(nf != npages || saved != 0)
+    fail("MADV_RANDOM should fault once per page");
+  munmap(m, npages * PGSIZE);
+
+  m = mmap(0, npages * PGSIZE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(m == (char*)-1)
+    fail("mmap failed");
+  if(madvise(m, npages * PGSIZE, MADV_SEQUENTIAL) < 0)
+    fail("madvise(SEQUENTIAL) failed");
+  nf = touch(m, npages, &saved);
+  if(nf != 1 || saved != npages - 1)
+    fail("MADV_SEQUENTIAL should map ahead to the end");
+  munmap(m, npages * PGSIZE);
+
+  // DONTNEED：堆页立即归还，再读是 0
+  char *p = sbrk(npages * PGSIZE);
+  if(p == (char*)-1)
+    fail("sbrk failed");
+  p += PGSIZE - (uint64)p % PGSIZE;     // 只对整页做 madvise
+  for(int i = 0; i < npages - 1; i++)
+    p[i * PGSIZE] = 1;
+  if(sysinfo(&before) < 0)
+    fail("sysinfo failed");
+  if(madvise(p, (npages - 1) * PGSIZE, MADV_DONTNEED) < 0)
+    fail("madvise(DONTNEED) failed");
+  if(sysinfo(&after) < 0)
+    fail("sysinfo failed");
+  if(after.freemem < before.freemem + (npages - 8) * PGSIZE)
+    fail("MADV_DONTNEED did not free the pages");
+  for(int i = 0; i < npages - 1; i++)
+    if(p[i * PGSIZE] != 0)
+      fail("page not zero after MADV_DONTNEED");
+
+  // WILLNEED：文件映射的页在 madvise 里就读进来，之后不再缺页
+  int fd = open("madvtmp", O_CREATE | O_RDWR);
+  if(fd < 0)
+    fail("open failed");
+  char buf[PGSIZE];
+  for(int i = 0; i < 8; i++){
+    memset(buf, 'A' + i, PGSIZE);
+    if(write(fd, buf, PGSIZE) != PGSIZE)
+      fail("write failed");
+  }
+  faultaround(1);
+  m = mmap(0, 8 * PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(m == (char*)-1)
+    fail("file mmap failed");
+  if(madvise(m, 8 * PGSIZE, MADV_WILLNEED) < 0)
+    fail("madvise(WILLNEED) failed");
+  faults(&f0, &s0);
+  for(int i = 0; i < 8; i++)
+    if(m[i * PGSIZE] != 'A' + i)
+      fail("file page has wrong contents");
+  faults(&f1, &s1);
+  if(f1 != f0)
+    fail("MADV_WILLNEED did not read the pages in");
+  munmap(m, 8 * PGSIZE);
+  close(fd);
+  remove("madvtmp");
+  faultaround(0);
+
+  // 不对齐，或者既不在堆里也不在 VMA 里
+  if(madvise(p + 1, PGSIZE, MADV_NORMAL) == 0)
+    fail("unaligned madvise succeeded");
+  if(madvise((char*)0x70000000, PGSIZE, MADV_DONTNEED) == 0)
+    fail("madvise on unmapped range succeeded");
+
+  printf("    OK\n");
+}
+
+static void
+test_populate_noreserve()
+{
+  printf("[10] MAP_POPULATE and MAP_NORESERVE...\n");
+
+  int npages = 16;
+  uint64 nf, saved, nf0, saved0;
+  struct sysinfo before, after;
+
+  // 预先映射的私有可写页：之后读写都不再缺页，内存在 mmap 时已经分配
+  if(sysinfo(&before) < 0)
+    fail("sysinfo failed");
+  char *m = mmap(0, npages * PGSIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if(m == (char*)-1)
+    fail("mmap MAP_POPULATE failed");
+  if(sysinfo(&after) < 0)
+    fail("sysinfo failed");
+  if(before.freemem < after.freemem + npages * PGSIZE)
+    fail("MAP_POPULATE did not allocate the pages");
+  nf = touch(m, npages, &saved);
+  if(nf != 0 || saved != 0)
+    fail("populated anonymous pages faulted");
+  munmap(m, npages * PGSIZE);
+
+  // 文件映射在 mmap 时读入
+  char *path = "popfile";
+  int fd = open(path, O_CREATE | O_RDWR);
+  if(fd < 0)
+    fail("cannot create popfile");
+  static char pg[PGSIZE];
+  for(int i = 0; i < npages; i++){
+    memset(pg, 'a' + i, PGSIZE);
+    if(write(fd, pg, PGSIZE) != PGSIZE)
+      fail("write popfile failed");
+  }
+  m = mmap(0, npages * PGSIZE, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if(m == (char*)-1)
+    fail("mmap file MAP_POPULATE failed");
+  faults(&nf0, &saved0);
+  for(int i = 0; i < npages; i++)
+    if(m[i * PGSIZE] != 'a' + i)
+      fail("populated file page has wrong contents");
+  faults(&nf, &saved);
+  if(nf != nf0)
+    fail("populated file pages faulted");
+  munmap(m, npages * PGSIZE);
+  remove(path);
+
+  // 稀疏区域：每次写只分配被访问的那一页，不替邻页分配
+  faultaround(8);
+  m = mmap(0, 64 * PGSIZE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(m == (char*)-1)
+    fail("mmap MAP_NORESERVE failed");
+  faults(&nf0, &saved0);
+  m[0] = 1;
+  m[20 * PGSIZE] = 2;
+  m[40 * PGSIZE + 7] = 3;
+  faults(&nf, &saved);
+  if(nf - nf0 != 3 || saved != saved0)
+    fail("MAP_NORESERVE write faults mapped neighbours");
+  if(m[0] != 1 || m[20 * PGSIZE] != 2 || m[40 * PGSIZE + 7] != 3 || m[PGSIZE] != 0)
+    fail("MAP_NORESERVE contents wrong");
+  // 显式的 madvise() 提示优先于 MAP_NORESERVE
+  if(madvise(m + 48 * PGSIZE, 16 * PGSIZE, MADV_SEQUENTIAL) < 0)
+    fail("madvise on MAP_NORESERVE area failed");
+  faults(&nf0, &saved0);
+  m[48 * PGSIZE] = 4;
+  faults(&nf, &saved);
+  if(nf - nf0 != 1 || saved == saved0)
+    fail("MADV_SEQUENTIAL ignored on MAP_NORESERVE area");
+  munmap(m, 64 * PGSIZE);
+  faultaround(0);
+
+  printf("    OK\n");
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
+  // test_shared_text() 启动的子进程：什么都不做
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+
   printf("lazytest starting\n");
 
   test_big_sparse_sbrk();
   test_read_into_lazy_page();
   test_fork_unmapped_semantics();
   test_negative_sbrk_unmap();
+  test_fault_around();
+  test_zero_page();
+  test_exec_demand_paging();
+  test_shared_text();
+  test_madvise();
+  test_populate_noreserve();
 
   printf("lazytest PASS\n");
   exit(0);
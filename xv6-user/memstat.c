@@ -0,0 +1,78 @@
+// memstat - 显示物理内存分配器的统计信息
+
+#include "kernel/include/types.h"
+#include "kernel/include/param.h"
+#include "kernel/include/sysinfo.h"
+#include "xv6-user/user.h"
+
+int main(int argc, char *argv[])
+{
+  struct sysinfo info;
+
+  if (sysinfo(&info) < 0) {
+    printf("memstat: sysinfo failed\n");
+    exit(1);
+  }
+
+  printf("free memory: %d KB\n", (int)(info.freemem >> 10));
+  printf("processes:   %d\n", (int)info.nproc);
+
+  printf("\nper-hart page cache:\n");
+  printf("HART  HIT       REFILL    DRAIN     CACHED\n");
+  for (int i = 0; i < NCPU; i++) {
+    printf("%d     %d        %d        %d        %d\n", i,
+           (int)info.pcp[i].hit, (int)info.pcp[i].refill,
+           (int)info.pcp[i].drain, (int)info.pcp[i].cached);
+  }
+
+  // 碎片化指数：空闲内存中无法用于满足该阶分配的比例（千分比）
+  uint64 total = 0;
+  for (int k = 0; k <= KMEM_MAX_ORDER; k++)
+    total += info.nr_free[k] << k;
+
+  printf("\nbuddy free blocks:\n");
+  printf("ORDER  BLOCKS  PAGES   UNUSABLE(1/1000)\n");
+  for (int k = 0; k <= KMEM_MAX_ORDER; k++) {
+    uint64 usable = 0;
+    for (int j = k; j <= KMEM_MAX_ORDER; j++)
+      usable += info.nr_free[j] << j;
+    int unusable = total ? (int)((total - usable) * 1000 / total) : 0;
+    printf("%d      %d       %d       %d\n", k, (int)info.nr_free[k],
+           (int)(info.nr_free[k] << k), unusable);
+  }
+
+  printf("\npre-zeroed pool: %d pages, hit %d, miss %d\n", (int)info.zcached,
+         (int)info.zhit, (int)info.zmiss);
+  printf("zero page: mapped %d times\n", (int)info.zpmapped);
+  printf("cow faults: copied %d, reused %d, from zero page %d\n",
+         (int)info.cowcopy, (int)info.cowreuse, (int)info.cowzero);
+  printf("file page cache: %d pages, hit %d, miss %d\n", (int)info.pcpages,
+         (int)info.pchit, (int)info.pcmiss);
+  printf("swap: %d/%d pages used, out %d, in %d\n", (int)info.swapused,
+         (int)info.swaptotal, (int)info.swapout, (int)info.swapin);
+  printf("zram: %d pages (%d same-filled) in %d bytes", (int)info.zrampages,
+         (int)info.zramsame, (int)info.zrambytes);
+  if (info.zrambytes > 0) {
+    uint64 raw = (info.zrampages - info.zramsame) * 4096 * 10;
+    printf(", ratio %d.%d", (int)(raw / info.zrambytes / 10),
+           (int)(raw / info.zrambytes % 10));
+  }
+  printf(", out %d, in %d\n", (int)info.zramout, (int)info.zramin);
+  printf("ksm: %s, %d pages shared, %d saved, %d merged, %d scanned in %d passes\n",
+         ksm(-1) ? "on" : "off", (int)info.ksmshared, (int)info.ksmsaved,
+         (int)info.ksmmerged, (int)info.ksmscanned, (int)info.ksmpasses);
+
+  printf("\nslab caches:\n");
+  printf("NAME          SIZE  INUSE   TOTAL   SLABS  ALLOCS    MAGHIT\n");
+  for (int i = 0; i < info.nslab; i++) {
+    struct slabinfo *s = &info.slab[i];
+    printf("%s", s->name);
+    for (int n = strlen(s->name); n < 14; n++)
+      printf(" ");
+    printf("%d    %d       %d       %d      %d        %d\n", (int)s->objsize,
+           (int)s->inuse, (int)s->total, (int)s->nslab, (int)s->nalloc,
+           (int)s->maghit);
+  }
+
+  exit(0);
+}
@@ -3,8 +3,42 @@
 #include "kernel/include/types.h"
 #include "kernel/include/stat.h"
 #include "kernel/include/fcntl.h"
+#include "kernel/include/sysinfo.h"
 #include "user.h"
 
+// 在子进程里读（write 为 0）或写 p；返回 1 表示子进程没有被杀死
+static int survives(char *p, int write)
+{
+    int pid = fork();
+    if (pid < 0) {
+        printf("FAIL: fork failed\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        if (write)
+            *(volatile char *)p = 'X';
+        else
+            (void)*(volatile char *)p;
+        exit(0);
+    }
+    int st;
+    wait(&st);
+    return st != -1;
+}
+
+static char fbuf[2 * 4096];
+
+// 用 read() 读回文件开头的 n 字节到 fbuf；返回读到的字节数
+static int readback(char *path, int n)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    int r = read(fd, fbuf, n);
+    close(fd);
+    return r;
+}
+
 // 简单的内存映射测试
 int main(int argc, char *argv[])
 {
@@ -96,15 +130,20 @@ int main(int argc, char *argv[])
     if (pid == 0) {
         // 子进程
         printf("Child read value: 0x%x\n", *data);
+        if (*data != 0x11111111) {
+            printf("FAIL: child does not see the parent's data\n");
+            exit(1);
+        }
         *data = 0x22222222;
         printf("Child wrote: 0x%x\n", *data);
         munmap(addr, 4096);
         exit(0);
     } else {
         // 父进程
-        wait(0);
+        int st;
+        wait(&st);
         printf("Parent read after child: 0x%x (should still be 0x11111111)\n", *data);
-        if (*data == 0x11111111) {
+        if (st == 0 && *data == 0x11111111) {
             printf("PASS: COW works correctly\n");
         } else {
             printf("FAIL: COW not working\n");
@@ -112,6 +151,275 @@ int main(int argc, char *argv[])
         munmap(addr, 4096);
     }
 
+    // 测试5：MAP_HUGETLB 大页映射（内存不足时内核退回 4K 页）
+    printf("\n=== Test 5: MAP_HUGETLB mapping ===\n");
+    uint64 huge = 2 * 1024 * 1024;
+    char *h = mmap(0, huge, PROT_READ | PROT_WRITE,
+                   MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (h == (char*)-1) {
+        printf("FAIL: mmap failed\n");
+        exit(1);
+    }
+    printf("mmap returned addr: %p (2 MiB)\n", h);
+    if (((uint64)h % huge) != 0) {
+        printf("FAIL: huge mapping not 2 MiB aligned\n");
+        exit(1);
+    }
+
+    // 第一次访问映射整块大页，之后的读写都不再缺页
+    int bad = 0;
+    if (h[0] != 0 || h[huge / 2] != 0 || h[huge - 1] != 0)
+        bad = 1;
+    h[0] = 'a';
+    h[huge / 2] = 'b';
+    h[huge - 1] = 'c';
+    if (h[0] != 'a' || h[huge / 2] != 'b' || h[huge - 1] != 'c')
+        bad = 1;
+    if (h[4096] != 0 || h[huge - 4096 - 1] != 0)
+        bad = 1;
+
+    // 只拆除中间一页，其余页保持可用
+    if (munmap(h + huge / 2, 4096) < 0)
+        bad = 1;
+    if (h[0] != 'a' || h[huge - 1] != 'c')
+        bad = 1;
+    munmap(h, huge);
+    if (bad) {
+        printf("FAIL: huge mapping contents wrong\n");
+        exit(1);
+    }
+    printf("PASS: huge mapping works\n");
+
+    // 测试6：mprotect 修改映射和堆的权限，越权访问的进程被杀死
+    printf("\n=== Test 6: mprotect ===\n");
+    char *m = mmap(0, 4 * 4096, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (m == (char*)-1) {
+        printf("FAIL: mmap failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < 4; i++)
+        m[i * 4096] = 'A' + i;
+    // 中间一页只读、最后一页 PROT_NONE：VMA 被切成几段
+    if (mprotect(m + 4096, 4096, PROT_READ) < 0 ||
+        mprotect(m + 3 * 4096, 4096, PROT_NONE) < 0) {
+        printf("FAIL: mprotect failed\n");
+        exit(1);
+    }
+    if (m[4096] != 'B' || m[0] != 'A' || m[2 * 4096] != 'C')
+        bad = 1;
+    m[0] = 'a';
+    m[2 * 4096] = 'c';
+    if (survives(m + 4096, 1) || survives(m + 3 * 4096, 0) ||
+        survives(m + 3 * 4096, 1))
+        bad = 1;
+    // 恢复权限后内容不变，且可以写
+    if (mprotect(m, 4 * 4096, PROT_READ | PROT_WRITE) < 0) {
+        printf("FAIL: mprotect failed\n");
+        exit(1);
+    }
+    if (m[4096] != 'B' || m[3 * 4096] != 'D' || m[0] != 'a')
+        bad = 1;
+    m[4096] = 'b';
+    m[3 * 4096] = 'd';
+    if (m[4096] != 'b' || m[3 * 4096] != 'd')
+        bad = 1;
+    munmap(m, 4 * 4096);
+
+    // sbrk 堆同样可以 mprotect；收缩后再增长的页恢复可写
+    char *brk = sbrk(0);
+    sbrk(4096 - (uint64)brk % 4096);
+    char *hp = sbrk(2 * 4096);
+    hp[0] = 'h';
+    if (mprotect(hp, 2 * 4096, PROT_READ) < 0) {
+        printf("FAIL: mprotect on heap failed\n");
+        exit(1);
+    }
+    if (hp[0] != 'h' || hp[4096] != 0 || survives(hp, 1) || survives(hp + 4096, 1))
+        bad = 1;
+    if (mprotect(hp, 4096, PROT_READ | PROT_WRITE) < 0)
+        bad = 1;
+    hp[0] = 'H';
+    // 收缩后的范围不能再通过 mprotect 登记的 VMA 缺页回来
+    sbrk(-2 * 4096);
+    if (survives(hp, 0) || survives(hp + 4096, 0))
+        bad = 1;
+    // 重新增长得到的是可读写的全零新页
+    if (sbrk(2 * 4096) != hp || hp[0] != 0 || hp[4096] != 0)
+        bad = 1;
+    hp[0] = 'y';
+    hp[4096] = 'x';
+    if (hp[0] != 'y' || hp[4096] != 'x')
+        bad = 1;
+
+    // 不对齐或越界的范围
+    if (mprotect(hp + 1, 4096, PROT_READ) == 0 ||
+        mprotect((char*)0x70000000, 4096, PROT_READ) == 0)
+        bad = 1;
+    if (bad) {
+        printf("FAIL: mprotect semantics wrong\n");
+        exit(1);
+    }
+    printf("PASS: mprotect works\n");
+
+    // 测试7：MAP_SHARED 文件映射，写入经 msync/munmap/exit 写回文件
+    printf("\n=== Test 7: Shared file mapping ===\n");
+    char *path = "mmapfile";
+    int fd = open(path, O_CREATE | O_RDWR), fd2;
+    if (fd < 0) {
+        printf("FAIL: cannot create %s\n", path);
+        exit(1);
+    }
+    for (int i = 0; i < 2 * 4096; i++)
+        fbuf[i] = 'a' + i % 26;
+    if (write(fd, fbuf, 2 * 4096) != 2 * 4096) {
+        printf("FAIL: write failed\n");
+        exit(1);
+    }
+    char *s = mmap(0, 2 * 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    char *q = mmap(0, 2 * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (s == (char*)-1 || q == (char*)-1) {
+        printf("FAIL: mmap of file failed\n");
+        exit(1);
+    }
+    if (s[0] != 'a' || s[4096] != 'a' + 4096 % 26 || q[1] != 'b')
+        bad = 1;
+
+    // 写映射后 msync，read() 能看到
+    s[1] = 'S';
+    if (msync(s, 4096, MS_SYNC) < 0 || readback(path, 2) != 2 || fbuf[1] != 'S')
+        bad = 1;
+    // 子进程通过继承的映射写入，父进程和文件都能看到
+    pid = fork();
+    if (pid == 0) {
+        s[4096] = 'C';
+        exit(0);
+    }
+    wait(0);
+    if (s[4096] != 'C' || readback(path, 4097) != 4097 || fbuf[4096] != 'C')
+        bad = 1;
+    // write() 写文件，共享映射看到新内容
+    fd2 = open(path, O_WRONLY);
+    if (fd2 < 0 || write(fd2, "W", 1) != 1)
+        bad = 1;
+    close(fd2);
+    if (s[0] != 'W')
+        bad = 1;
+    // 私有映射写入不会到达文件；fork 出的子进程看到父进程的私有副本
+    q[2] = 'P';
+    if (readback(path, 3) != 3 || fbuf[2] != 'c')
+        bad = 1;
+    pid = fork();
+    if (pid == 0) {
+        int ok = q[2] == 'P';
+        q[2] = 'K';
+        exit(ok ? 0 : 1);
+    }
+    int st7;
+    wait(&st7);
+    if (st7 != 0 || q[2] != 'P')
+        bad = 1;
+    // MADV_DONTNEED 丢弃页面之前写回脏页
+    s[3] = 'D';
+    if (madvise(s, 4096, MADV_DONTNEED) < 0 || readback(path, 4) != 4 ||
+        fbuf[3] != 'D' || s[3] != 'D')
+        bad = 1;
+    // munmap 写回脏页
+    s[4096 + 1] = 'M';
+    munmap(s, 2 * 4096);
+    if (readback(path, 4098) != 4098 || fbuf[4097] != 'M')
+        bad = 1;
+    // 非法参数：不对齐的 offset，ASYNC 与 SYNC 同时给出，只读文件的共享可写映射
+    fd2 = open(path, O_RDONLY);
+    if (mmap(0, 4096, PROT_READ, MAP_SHARED, fd, 1) != (void*)-1 ||
+        mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd2, 0) != (void*)-1 ||
+        msync(q, 4096, MS_ASYNC | MS_SYNC) == 0)
+        bad = 1;
+    close(fd2);
+    munmap(q, 2 * 4096);
+    close(fd);
+    remove(path);
+    if (bad) {
+        printf("FAIL: shared file mapping semantics wrong\n");
+        exit(1);
+    }
+    printf("PASS: shared file mapping works\n");
+
+    // 测试8：大量映射，VMA 数量不受限制，查找和分配空闲范围都正确
+    printf("\n=== Test 8: Many mappings ===\n");
+    static char *arena[128];
+    for (int i = 0; i < 128; i++) {
+        arena[i] = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (arena[i] == (char*)-1) {
+            printf("FAIL: mmap #%d failed\n", i);
+            exit(1);
+        }
+        arena[i][0] = i;
+    }
+    // 隔一个释放一个，空出来的洞被新映射重新使用
+    for (int i = 0; i < 128; i += 2)
+        munmap(arena[i], 4096);
+    for (int i = 0; i < 128; i += 2) {
+        arena[i] = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (arena[i] == (char*)-1) {
+            printf("FAIL: mmap into hole failed\n");
+            exit(1);
+        }
+        arena[i][0] = i;
+    }
+    for (int i = 0; i < 128; i++) {
+        if (arena[i][0] != (char)i)
+            bad = 1;
+        munmap(arena[i], 4096);
+    }
+    if (bad) {
+        printf("FAIL: many mappings wrong\n");
+        exit(1);
+    }
+    printf("PASS: many mappings work\n");
+
+    // 测试9：部分 munmap 切开 VMA，页面真正归还
+    printf("\n=== Test 9: Partial munmap ===\n");
+    char *u = mmap(0, 4 * 4096, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (u == (char*)-1) {
+        printf("FAIL: mmap failed\n");
+        exit(1);
+    }
+    for (int i = 0; i < 4; i++)
+        u[i * 4096] = 'A' + i;
+    // 拆掉中间两页：两头保留原内容，中间的访问会杀死进程
+    if (munmap(u + 4096, 2 * 4096) < 0)
+        bad = 1;
+    if (u[0] != 'A' || u[3 * 4096] != 'D' || survives(u + 4096, 0) ||
+        survives(u + 2 * 4096, 1))
+        bad = 1;
+    // 跨越空洞拆掉剩下的两段；之后范围内没有 VMA，再 munmap 失败
+    if (munmap(u, 4 * 4096) < 0 || survives(u, 0) || survives(u + 3 * 4096, 0))
+        bad = 1;
+    if (munmap(u, 4 * 4096) == 0 || munmap(u + 1, 4096) == 0)
+        bad = 1;
+    // 反复映射、写满、拆除，空闲内存不减少
+    struct sysinfo before, after;
+    sysinfo(&before);
+    for (int round = 0; round < 8; round++) {
+        char *r = mmap(0, 64 * 4096, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (r == (char*)-1) {
+            printf("FAIL: mmap failed\n");
+            exit(1);
+        }
+        for (int i = 0; i < 64; i++)
+            r[i * 4096] = i;
+        munmap(r, 32 * 4096);
+        munmap(r + 32 * 4096, 32 * 4096);
+    }
+    sysinfo(&after);
+    if (before.freemem > after.freemem + 4 * 4096)
+        bad = 1;
+    if (bad) {
+        printf("FAIL: partial munmap wrong\n");
+        exit(1);
+    }
+    printf("PASS: partial munmap works\n");
+
     printf("\n=== All tests completed ===\n");
     exit(0);
 }
@@ -28,8 +28,8 @@ int main(int argc, char *argv[])
   }
 
   // Print header
-  printf("PID   STATE     PRIO QLV TIME_SLICE TICKS UTIME STIME START_T  SZ  NAME\n");
-  printf("----  --------  ---- --- --------- ----- ----- ----- ------ ----- ----\n");
+  printf("PID   STATE     PRIO QLV TIME_SLICE TICKS UTIME STIME START_T  SZ  FLT SAVED NAME\n");
+  printf("----  --------  ---- --- --------- ----- ----- ----- ------ ----- --- ----- ----\n");
 
   // Print process information
   for(int i = 0; i < count; i++) {
@@ -40,7 +40,7 @@ int main(int argc, char *argv[])
       state_str = "UNKNOWN ";
     }
 
-    printf("%d %s %d %d %d %d %d %d %d %d %s\n",
+    printf("%d %s %d %d %d %d %d %d %d %d %d %d %s\n",
            info[i].pid,
            state_str,
            info[i].priority,
@@ -51,6 +51,8 @@ int main(int argc, char *argv[])
            (int)info[i].stime,
            (int)info[i].start_time,
            (int)info[i].sz,
+           (int)info[i].nfault,
+           (int)info[i].nfault_saved,
            info[i].name);
   }
 
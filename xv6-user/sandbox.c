@@ -67,6 +67,12 @@ static struct name_num table[] = {
   {"mmap", SYS_mmap},
   {"munmap", SYS_munmap},
   {"sandbox", SYS_sandbox},
+  {"faultaround", SYS_faultaround},
+  {"spawn", SYS_spawn},
+  {"ksm", SYS_ksm},
+  {"madvise", SYS_madvise},
+  {"mprotect", SYS_mprotect},
+  {"msync", SYS_msync},
 };
 
 static void
@@ -3,6 +3,7 @@
 #include "kernel/include/types.h"
 #include "xv6-user/user.h"
 #include "kernel/include/fcntl.h"
+#include "kernel/include/spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -152,6 +153,78 @@ replace(char *buf)
   return n;
 }
 
+// dst = dir + "/" + name
+void
+envpath(char *dst, char *dir, char *name)
+{
+  while((*dst = *dir++))
+    dst++;
+  *dst++ = '/';
+  while((*dst++ = *name++))
+    ;
+}
+
+// Run a plain command, with or without redirections, through spawn()
+// so the shell's memory is never copied. Redirected files are opened
+// here and handed to the child as spawn file actions.
+// Returns the child's pid, 0 if the command failed before a child was
+// started, or -1 if cmd needs a forked shell (pipes, lists, '&').
+int
+spawncmd(struct cmd *cmd)
+{
+  struct spawn_action act[SPAWN_MAXACT];
+  int fds[SPAWN_MAXACT / 2];
+  int nact = 0, nfd = 0, pid = 0, i;
+  struct redircmd *rcmd;
+  struct execcmd *ecmd;
+  struct cmd *c;
+  char env_cmd[128];
+
+  for(c = cmd; c->type == REDIR; c = ((struct redircmd*)c)->cmd)
+    nfd++;
+  if(c->type != EXEC || nfd > SPAWN_MAXACT / 2)
+    return -1;
+  ecmd = (struct execcmd*)c;
+
+  // same order as runcmd(): the outer redirection first, so an inner
+  // one for the same fd wins.
+  nfd = 0;
+  for(c = cmd; c->type == REDIR; c = rcmd->cmd){
+    rcmd = (struct redircmd*)c;
+    if((fds[nfd] = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      goto out;
+    }
+    act[nact].op = SPAWN_DUP2;
+    act[nact].fd = fds[nfd];
+    act[nact].newfd = rcmd->fd;
+    nact++;
+    nfd++;
+  }
+  for(i = 0; i < nfd; i++){
+    act[nact].op = SPAWN_CLOSE;
+    act[nact].fd = fds[i];
+    nact++;
+  }
+
+  if(ecmd->argv[0] == 0)
+    goto out;
+  pid = spawn(ecmd->argv[0], ecmd->argv, act, nact);
+  for(i = 0; pid < 0 && i < nenv; i++){
+    envpath(env_cmd, envs[i].value, ecmd->argv[0]);
+    pid = spawn(env_cmd, ecmd->argv, act, nact);
+  }
+  if(pid < 0){
+    fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+    pid = 0;
+  }
+
+out:
+  for(i = 0; i < nfd; i++)
+    close(fds[i]);
+  return pid;
+}
+
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
@@ -178,18 +251,10 @@ runcmd(struct cmd *cmd)
     exec(ecmd->argv[0], ecmd->argv);
 
     int i;
-    char env_cmd[64];
+    char env_cmd[128];
     for(i=0; i<nenv; i++)
     {
-      char *s_tmp = env_cmd;
-      char *d_tmp = envs[i].value;
-      while((*s_tmp = *d_tmp++))
-        s_tmp++;
-      *s_tmp++ = '/';
-      d_tmp = ecmd->argv[0];
-      while((*s_tmp++ = *d_tmp++))
-        ;
-
+      envpath(env_cmd, envs[i].value, ecmd->argv[0]);
       exec(env_cmd, ecmd->argv);
     }
     fprintf(2, "exec %s failed\n", ecmd->argv[0]);
@@ -261,7 +326,7 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, pid;
 
   // Ensure that three file descriptors are open.
   while((fd = dev(O_RDWR, 1, 0)) >= 0){
@@ -306,9 +371,15 @@ main(void)
         free(cmd);
         continue;
       }
-      else if(fork1() == 0) 
-        runcmd(cmd);
-      wait(0);
+      else if((pid = spawncmd(cmd)) >= 0) {
+        if(pid > 0)
+          wait(0);
+      }
+      else {
+        if(fork1() == 0)
+          runcmd(cmd);
+        wait(0);
+      }
       free(cmd);
     }
   }
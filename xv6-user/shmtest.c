@@ -8,6 +8,8 @@
 
 #define SHM_KEY 1234
 #define SHM_SIZE 4096
+#define SHM_BIG_KEY 5678
+#define SHM_BIG_PAGES 3
 
 int main(int argc, char *argv[])
 {
@@ -106,6 +108,31 @@ int main(int argc, char *argv[])
     printf("[父进程] 删除共享内存成功\n");
   }
 
+  // 多页共享内存段：每一页都应当是真实分配、互不重叠的物理页
+  printf("\n[父进程] 创建 %d 页的共享内存段...\n", SHM_BIG_PAGES);
+  shmid = shmget(SHM_BIG_KEY, SHM_BIG_PAGES * 4096, IPC_CREAT);
+  if (shmid < 0) {
+    printf("shmget 失败!\n");
+    exit(1);
+  }
+  shm_ptr = (char*)shmat(shmid, 0, 0);
+  if (shm_ptr == (char*)-1) {
+    printf("shmat 失败!\n");
+    exit(1);
+  }
+  for (i = 0; i < SHM_BIG_PAGES; i++) {
+    shm_ptr[i * 4096] = 'X' + i;
+    shm_ptr[i * 4096 + 4095] = 'x' + i;
+  }
+  int ok = 1;
+  for (i = 0; i < SHM_BIG_PAGES; i++) {
+    if (shm_ptr[i * 4096] != 'X' + i || shm_ptr[i * 4096 + 4095] != 'x' + i)
+      ok = 0;
+  }
+  printf("[父进程] 多页共享内存读写%s\n", ok ? "正确" : "错误!");
+  shmdt((uint64)shm_ptr);
+  shmctl(shmid, SHM_RMID, 0);
+
   printf("\n=== 共享内存 IPC 测试完成 ===\n");
   exit(0);
 }
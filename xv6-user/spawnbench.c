@@ -0,0 +1,84 @@
+// spawnbench - 比较 spawn() 与 fork()+exec() 创建进程的速度
+//
+// 父进程先持有一个工作集（默认 64 页），再反复启动一个立即退出的子进程。
+// fork() 需要按页复制父进程的页表并增加引用计数，随后又被 exec() 丢弃；
+// spawn() 直接为子进程装入新程序，开销与父进程大小无关。
+//
+// 用法: spawnbench [rounds] [pages]
+
+#include "kernel/include/types.h"
+#include "kernel/include/stat.h"
+#include "xv6-user/user.h"
+
+#define PGSIZE 4096
+#define SELF "/bin/spawnbench"
+
+static char *childargv[] = { "spawnbench", "-x", 0 };
+
+static int
+run_fork(int rounds)
+{
+  int start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("spawnbench: fork failed\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      exec(SELF, childargv);
+      printf("spawnbench: exec %s failed\n", SELF);
+      exit(1);
+    }
+    wait(0);
+  }
+  return uptime() - start;
+}
+
+static int
+run_spawn(int rounds)
+{
+  int start = uptime();
+  for (int i = 0; i < rounds; i++) {
+    if (spawn(SELF, childargv, 0, 0) < 0) {
+      printf("spawnbench: spawn %s failed\n", SELF);
+      exit(1);
+    }
+    wait(0);
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds = 200;
+  int pages = 64;
+
+  if (argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if (argc > 1)
+    rounds = atoi(argv[1]);
+  if (argc > 2)
+    pages = atoi(argv[2]);
+  if (rounds <= 0 || pages < 0) {
+    printf("usage: spawnbench [rounds] [pages]\n");
+    exit(1);
+  }
+
+  // 父进程的工作集必须真实映射，fork 才需要复制它的页表
+  char *ws = sbrk(pages * PGSIZE);
+  if (ws == (char *)-1) {
+    printf("spawnbench: sbrk failed\n");
+    exit(1);
+  }
+  for (int i = 0; i < pages; i++)
+    ws[i * PGSIZE] = i;
+
+  printf("spawnbench: %d children, parent holds %d pages\n", rounds, pages);
+  int tf = run_fork(rounds);
+  int ts = run_spawn(rounds);
+  printf("  fork+exec: %d ticks, %d per 100 ticks\n", tf, tf > 0 ? 100 * rounds / tf : 100 * rounds);
+  printf("  spawn:     %d ticks, %d per 100 ticks\n", ts, ts > 0 ? 100 * rounds / ts : 100 * rounds);
+  exit(0);
+}
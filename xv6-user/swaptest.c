@@ -0,0 +1,176 @@
+// swaptest - 申请比空闲物理内存更多的堆，检查换出 / 换入后数据不变
+// 可压缩的页应进入压缩交换区（zram），不可压缩的页才写入交换文件
+
+#include "kernel/include/types.h"
+#include "kernel/include/param.h"
+#include "kernel/include/sysinfo.h"
+#include "xv6-user/user.h"
+
+#define PGSIZE 4096
+
+static void
+fail(const char *msg)
+{
+  printf("swaptest FAIL: %s\n", msg);
+  exit(1);
+}
+
+static uint64
+pattern(int i)
+{
+  return (uint64)i * 2654435761u + 1;
+}
+
+// 每页写入自己的编号，再全部读回检查
+static void
+fill(char *base, int npages)
+{
+  for(int i = 0; i < npages; i++)
+    *(uint64*)(base + (uint64)i * PGSIZE) = pattern(i);
+}
+
+static void
+check(char *base, int npages, const char *what)
+{
+  for(int i = 0; i < npages; i++){
+    if(*(uint64*)(base + (uint64)i * PGSIZE) != pattern(i)){
+      printf("page %d: ", i);
+      fail(what);
+    }
+  }
+}
+
+static void
+test_overcommit(char *base, int npages)
+{
+  struct sysinfo before, after;
+
+  printf("[1] %d pages, more than free memory...\n", npages);
+  if(sysinfo(&before) < 0)
+    fail("sysinfo failed");
+  fill(base, npages);
+  check(base, npages, "data changed after swapping");
+  if(sysinfo(&after) < 0)
+    fail("sysinfo failed");
+  if(after.swapout + after.zramout <= before.swapout + before.zramout ||
+     after.swapin + after.zramin <= before.swapin + before.zramin)
+    fail("nothing went through swap");
+  // 这些页几乎全是 0，应当全部压缩留在内存里
+  if(after.zramout <= before.zramout)
+    fail("compressible pages were not compressed");
+  printf("    OK (zram out %d, in %d; disk out %d, in %d)\n",
+         (int)(after.zramout - before.zramout),
+         (int)(after.zramin - before.zramin),
+         (int)(after.swapout - before.swapout),
+         (int)(after.swapin - before.swapin));
+}
+
+static void
+test_fork(char *base, int npages)
+{
+  printf("[2] fork shares swapped pages copy-on-write...\n");
+
+  int pid = fork();
+  if(pid < 0)
+    fail("fork failed");
+  if(pid == 0){
+    check(base, npages, "child sees wrong data");
+    for(int i = 0; i < npages; i += 2)
+      *(uint64*)(base + (uint64)i * PGSIZE) = 0;
+    exit(0);
+  }
+  int st;
+  wait(&st);
+  if(st != 0)
+    fail("child failed");
+  check(base, npages, "child writes leaked into parent");
+  printf("    OK\n");
+}
+
+static uint64
+xorshift(uint64 *s)
+{
+  uint64 x = *s;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *s = x;
+}
+
+// 整页填满伪随机数，压缩不了
+static void
+fillrand(char *base, int npages)
+{
+  for(int i = 0; i < npages; i++){
+    uint64 s = pattern(i), *w = (uint64*)(base + (uint64)i * PGSIZE);
+    for(int j = 0; j < PGSIZE / sizeof(uint64); j++)
+      w[j] = xorshift(&s);
+  }
+}
+
+static void
+checkrand(char *base, int npages)
+{
+  for(int i = 0; i < npages; i++){
+    uint64 s = pattern(i), *w = (uint64*)(base + (uint64)i * PGSIZE);
+    for(int j = 0; j < PGSIZE / sizeof(uint64); j++){
+      if(w[j] != xorshift(&s)){
+        printf("page %d: ", i);
+        fail("random data changed after swapping");
+      }
+    }
+  }
+}
+
+static void
+test_incompressible(void)
+{
+  struct sysinfo before, after;
+
+  if(sysinfo(&before) < 0)
+    fail("sysinfo failed");
+  if(before.swaptotal == 0){
+    printf("[3] no swap file, skipped\n");
+    return;
+  }
+  int npages = before.freemem / PGSIZE + before.swaptotal / 4;
+  if(npages > before.freemem / PGSIZE + before.swaptotal - before.swapused - 64)
+    npages = before.freemem / PGSIZE + before.swaptotal - before.swapused - 64;
+  printf("[3] %d incompressible pages go to the swap file...\n", npages);
+  char *base = sbrk(npages * PGSIZE);
+  if(base == (char*)-1)
+    fail("sbrk failed");
+  fillrand(base, npages);
+  checkrand(base, npages);
+  if(sysinfo(&after) < 0)
+    fail("sysinfo failed");
+  if(after.swapout <= before.swapout || after.swapin <= before.swapin)
+    fail("nothing went to the swap file");
+  sbrk(-npages * PGSIZE);
+  printf("    OK (out %d, in %d)\n", (int)(after.swapout - before.swapout),
+         (int)(after.swapin - before.swapin));
+}
+
+int
+main(void)
+{
+  struct sysinfo info;
+
+  printf("swaptest starting\n");
+  if(sysinfo(&info) < 0)
+    fail("sysinfo failed");
+
+  // 比空闲内存多出 SWAP_PAGES / 4 页，压缩后都能留在内存里
+  int npages = info.freemem / PGSIZE + SWAP_PAGES / 4;
+  char *base = sbrk(npages * PGSIZE);
+  if(base == (char*)-1)
+    fail("sbrk failed");
+
+  test_overcommit(base, npages);
+  test_fork(base, npages);
+  sbrk(-npages * PGSIZE);
+  test_incompressible();
+
+  printf("swaptest PASS\n");
+  exit(0);
+}
@@ -6,6 +6,7 @@ struct stat;
 struct rtcdate;
 struct sysinfo;
 struct procinfo;
+struct spawn_action;
 
 // Signal definitions
 #define SIGHUP    1
@@ -79,6 +80,7 @@ int shmctl(int shmid, int cmd, void *buf);
 int sandbox(int on, int action, uint32 *allow_mask, int words);
 
 // mmap system calls
+#define PROT_NONE   0x0
 #define PROT_READ   0x1
 #define PROT_WRITE  0x2
 #define PROT_EXEC   0x4
@@ -87,9 +89,28 @@ int sandbox(int on, int action, uint32 *allow_mask, int words);
 #define MAP_PRIVATE 0x02
 #define MAP_FIXED   0x04
 #define MAP_ANONYMOUS 0x08
+#define MAP_HUGETLB 0x10
+#define MAP_POPULATE 0x20
+#define MAP_NORESERVE 0x40
+
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
+
+#define MS_ASYNC        1
+#define MS_INVALIDATE   2
+#define MS_SYNC         4
 
 void* mmap(void *addr, uint length, int prot, int flags, int fd, uint offset);
 int munmap(void *addr, uint length);
+int madvise(void *addr, uint length, int advice);
+int mprotect(void *addr, uint length, int prot);
+int msync(void *addr, uint length, int flags);
+int faultaround(int npages);
+int spawn(char *path, char **argv, struct spawn_action *act, int nact);
+int ksm(int on);
 
 // Signal system calls
 void (*signal(int sig, void (*handler)(int)))(int);
@@ -59,3 +59,9 @@ entry("settime");
 entry("mmap");
 entry("munmap");
 entry("sandbox");
+entry("faultaround");
+entry("spawn");
+entry("ksm");
+entry("madvise");
+entry("mprotect");
+entry("msync");
@@ -40,8 +40,7 @@ int main(int argc, char *argv[])
     i--;
     if (readline(0, buf, 128) == 0) {   // if there is no input
         argvs[i] = 0;
-        if (fork() == 0) {
-            exec(argv[1], argvs);
+        if (spawn(argv[1], argvs, 0, 0) < 0) {
             printf("xargs: exec %s fail\n", argv[1]);
             exit(0);
         }
@@ -50,8 +49,7 @@ int main(int argc, char *argv[])
         argvs[i] = buf;
         argvs[i + 1] = 0;
         do {
-            if (fork() == 0) {
-                exec(argv[1], argvs);
+            if (spawn(argv[1], argvs, 0, 0) < 0) {
                 printf("xargs: exec %s fail\n", argv[1]);
                 exit(0);
             }